@@ -0,0 +1,246 @@
+/**
+ * Runtime of Vio programs compiled ahead of time to C++.
+ */
+
+#ifndef VioAotRuntime_h
+#define VioAotRuntime_h
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+#include "../vm/VioVM.h"
+
+/**
+ * Compiled code object: takes the stack pointer above its args,
+ * returns it above its result, which replaces them.
+ */
+using AotEntry = VioValue* (*)(VioValue* sp);
+
+/**
+ * Function of a compiled code object.
+ */
+struct AotFunction : public FunctionObject {
+  AotFunction(CodeObject* co, AotEntry entry)
+      : FunctionObject(co), entry(entry) {}
+  AotEntry entry;
+};
+
+// --------------------------------------------------
+// Instructions, on the local `sp` of a compiled function.
+
+/**
+ * Arithmetic (math `opcode`): integers and numbers in place, like the
+ * interpreter's BINARY_OP otherwise (strings concatenate, other
+ * operands are dropped).
+ */
+#define AOT_BINARY_OP(opcode)                               \
+  do {                                                      \
+    int64_t result;                                         \
+    if (IS_INTEGER(sp[-2]) && IS_INTEGER(sp[-1]) &&         \
+        integerOp(opcode, sp[-2].integer, sp[-1].integer, result)) { \
+      sp[-2].integer = result;                              \
+      sp--;                                                 \
+    } else if (IS_NUMERIC(sp[-2]) && IS_NUMERIC(sp[-1])) {  \
+      sp[-2] = numericOp(opcode, sp[-2], sp[-1]);           \
+      sp--;                                                 \
+    } else {                                                \
+      sp = VioAotRuntime::concat(sp);                       \
+    }                                                       \
+  } while (false)
+
+/**
+ * Comparison (compare op `index` of OP_COMPARE).
+ */
+#define AOT_COMPARE(op, index)                              \
+  do {                                                      \
+    if (IS_INTEGER(sp[-2]) && IS_INTEGER(sp[-1])) {         \
+      sp[-2] = BOOLEAN(sp[-2].integer op sp[-1].integer);   \
+      sp--;                                                 \
+    } else if (IS_NUMBER(sp[-2]) && IS_NUMBER(sp[-1])) {    \
+      sp[-2] = BOOLEAN(sp[-2].number op sp[-1].number);     \
+      sp--;                                                 \
+    } else if (IS_NUMERIC(sp[-2]) && IS_NUMERIC(sp[-1])) {  \
+      sp[-2] = BOOLEAN(numericCompare(index, sp[-2], sp[-1])); \
+      sp--;                                                 \
+    } else {                                                \
+      sp = VioAotRuntime::compare(sp, index);               \
+    }                                                       \
+  } while (false)
+
+/**
+ * Calls `entry` on the `argc` args on the stack.
+ */
+#define AOT_CALL_DIRECT(callee, argc, entry) \
+  do {                                       \
+    sp = entry(sp);                          \
+  } while (false)
+
+/**
+ * Globals, natives and the stack of a compiled program. Natives are
+ * the VM's (they run on its stack), so a program compiled to C++ sees
+ * the same globals as in the interpreter.
+ */
+class VioAotRuntime {
+ public:
+  VioAotRuntime() { vm.setTrace(false); }
+
+  /**
+   * Defines the globals of the program, in compile order. The first
+   * ones are the VM's predefined globals.
+   */
+  void defineGlobals(std::initializer_list<const char*> names) {
+    size_t index = 0;
+    for (auto name : names) {
+      if (index < vm.global->globals.size() &&
+          vm.global->globals[index].name != name) {
+        DIE << "VioAotRuntime: global " << index << " is "
+            << vm.global->globals[index].name << ", compiled as " << name;
+      }
+      vm.global->define(name);
+      index++;
+    }
+    globals = vm.global->globals.data();
+  }
+
+  /**
+   * Allocates the function of a compiled code object.
+   */
+  VioValue function(const std::string& name, size_t arity, AotEntry entry) {
+    auto co = new CodeObject(name, arity);
+    return (VioValue){VioValueType::OBJECT,
+                      .object = (Object*)new AotFunction(co, entry)};
+  }
+
+  /**
+   * Code object of a function.
+   */
+  static VioValue code(const VioValue& function) {
+    return (VioValue){VioValueType::OBJECT,
+                      .object = (Object*)AS_FUNCTION(function)->co};
+  }
+
+  /**
+   * Dies unless `count` more values fit on the stack above `sp`.
+   */
+  void reserve(VioValue* sp, size_t count) {
+    if ((size_t)(vm.stack.data() + STACK_LIMIT - sp) < count) {
+      DIE << "stack overflow error \n";
+    }
+  }
+
+  /**
+   * Generic call of the callee below `argsCount` args.
+   */
+  VioValue* call(VioValue* sp, uint8_t argsCount) {
+    auto fnValue = sp[-argsCount - 1];
+
+    if (IS_NATIVE(fnValue)) {
+      auto native = AS_NATIVE(fnValue);
+      if (argsCount != native->arity) {
+        DIE << "OP_CALL: " << native->name << " expects " << native->arity
+            << " arguments, got " << (int)argsCount;
+      }
+      vm.sp = sp;
+      native->function();
+      auto result = vm.pop();
+      vm.popN(argsCount + 1);  // pop args and function object itself
+      vm.push(result);
+      return vm.sp;
+    }
+
+    if (!IS_FUNCTION(fnValue)) {
+      DIE << "OP_CALL: not a function";
+    }
+    auto callee = (AotFunction*)AS_FUNCTION(fnValue);
+    if (argsCount != callee->co->arity) {
+      DIE << "OP_CALL: " << callee->co->name << " expects "
+          << callee->co->arity << " arguments, got " << (int)argsCount;
+    }
+    // the result replaces the function object
+    sp = callee->entry(sp);
+    sp[-2] = sp[-1];
+    return sp - 1;
+  }
+
+  /**
+   * Runs the main function from an empty stack, returns its result.
+   */
+  VioValue run(AotEntry main) {
+    auto sp = main(vm.stack.data());
+    if (sp == vm.stack.data()) {
+      DIE << "pop(): empty stack. \n";
+    }
+    if (!vm.runQueue.empty()) {
+      DIE << "VioAotRuntime: spawned fibers run in the interpreter only";
+    }
+    return sp[-1];
+  }
+
+  /**
+   * Arithmetic on non-numbers.
+   */
+  static VioValue* concat(VioValue* sp) {
+    auto& op1 = sp[-2];
+    auto& op2 = sp[-1];
+    if (IS_STRING(op1) && IS_STRING(op2)) {
+      op1 = ALLOC_STRING(AS_CPPSTRING(op1) + AS_CPPSTRING(op2));
+      return sp - 1;
+    }
+    return sp - 2;
+  }
+
+  /**
+   * Comparison of non-numbers.
+   */
+  static VioValue* compare(VioValue* sp, uint8_t op) {
+    auto& op1 = sp[-2];
+    auto& op2 = sp[-1];
+    if (!IS_STRING(op1) || !IS_STRING(op2)) {
+      return sp - 2;
+    }
+    auto s1 = AS_CPPSTRING(op1);
+    auto s2 = AS_CPPSTRING(op2);
+    bool res = false;
+    switch (op) {
+      case 0:
+        res = s1 < s2;
+        break;
+      case 1:
+        res = s1 > s2;
+        break;
+      case 2:
+        res = s1 == s2;
+        break;
+      case 3:
+        res = s1 >= s2;
+        break;
+      case 4:
+        res = s1 <= s2;
+        break;
+      case 5:
+        res = s1 != s2;
+        break;
+    }
+    op1 = BOOLEAN(res);
+    return sp - 1;
+  }
+
+  /**
+   * VM of the natives and predefined globals, and the stack.
+   */
+  VioVM vm;
+
+  /**
+   * The program's objects belong to the VM's heap.
+   */
+  VioHeapScope heapScope{vm.heap};
+
+  /**
+   * Globals, fixed once defined.
+   */
+  GlobalVar* globals = nullptr;
+};
+
+#endif
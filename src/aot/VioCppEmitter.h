@@ -0,0 +1,387 @@
+/**
+ * Ahead-of-time compiler of Vio programs to C++.
+ */
+
+#ifndef VioCppEmitter_h
+#define VioCppEmitter_h
+
+#include <cmath>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Logger.h"
+#include "../bytecode/OpCode.h"
+#include "../cache/VioImage.h"
+#include "../vm/Global.h"
+#include "../vm/VioValue.h"
+
+/**
+ * Translates a compiled program to a standalone C++ translation unit,
+ * built with the runtime of `VioAotRuntime.h`:
+ *
+ *   c++ -std=c++17 -O2 -I<repo> program.cpp -o program
+ *
+ * Each code object becomes a C++ function `fn_<i>` working on the
+ * operand stack like the interpreter: instructions are statements on
+ * a local stack pointer, jumps are gotos, and number and boolean
+ * constants are literals, so the C++ compiler sees the whole
+ * program. Direct calls are C++ calls. With -DVIO_AOT_LIBRARY there
+ * is no `main`, and `vioMain` runs the program.
+ */
+class VioCppEmitter {
+ public:
+  /**
+   * Returns the C++ source of the program of the `main` entry
+   * function.
+   */
+  std::string emit(FunctionObject* main, Global& global) {
+    if (!reachableCodeObjects(main->co, codeObjects_, indices_)) {
+      DIE << "--emit-cpp: the program has constants which can't be "
+             "compiled to C++";
+    }
+    out_.str("");
+
+    out_ << "/**\n"
+         << " * Generated by vio-vm --emit-cpp.\n"
+         << " */\n\n"
+         << "#include \"src/aot/VioAotRuntime.h\"\n\n"
+         << "static VioAotRuntime rt;\n\n";
+
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      out_ << "static VioValue* fn_" << i << "(VioValue* sp);  // "
+           << codeObjects_[i]->name << "/" << codeObjects_[i]->arity << "\n";
+    }
+    out_ << "\n";
+
+    // Functions, and constant pools of the strings.
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      out_ << "static VioValue f" << i << ";\n";
+    }
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      if (hasStrings(codeObjects_[i])) {
+        out_ << "static VioValue k" << i << "["
+             << codeObjects_[i]->constants.size() << "];\n";
+      }
+    }
+    out_ << "\n";
+
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      function(i);
+    }
+
+    init(global);
+
+    out_ << "/**\n"
+         << " * Runs the program, returns its result.\n"
+         << " */\n"
+         << "extern \"C\" VioValue vioMain() {\n"
+         << "  static bool initialized = (init(), true);\n"
+         << "  (void)initialized;\n"
+         << "  return rt.run(fn_0);\n"
+         << "}\n\n"
+         << "#ifndef VIO_AOT_LIBRARY\n"
+         << "int main() {\n"
+         << "  auto result = vioMain();\n"
+         << "  log(result);\n"
+         << "  return 0;\n"
+         << "}\n"
+         << "#endif\n";
+
+    return out_.str();
+  }
+
+ private:
+  /**
+   * C++ function of the code object `i`.
+   */
+  void function(size_t i) {
+    auto co = codeObjects_[i];
+    auto code = co->codeBegin();
+    auto size = co->codeSize();
+
+    std::set<size_t> starts;
+    std::set<size_t> targets;
+    size_t count = 0;
+    bool locals = false;
+    uint8_t last = OP_HALT;
+    for (size_t offset = 0; offset < size; offset += opcodeSize(code[offset])) {
+      auto opcode = code[offset];
+      if (offset + opcodeSize(opcode) > size) {
+        DIE << "--emit-cpp: truncated instruction in " << co->name;
+      }
+      if (opcode == OP_JMP || opcode == OP_JMP_IF_FALSE) {
+        targets.insert(jumpTarget(code, offset));
+      }
+      locals |= opcode == OP_GET_LOCAL || opcode == OP_SET_LOCAL;
+      starts.insert(offset);
+      last = opcode;
+      count++;
+    }
+    for (auto target : targets) {
+      if (target != size && starts.count(target) == 0) {
+        DIE << "--emit-cpp: jump into an instruction in " << co->name;
+      }
+    }
+
+    out_ << "// " << co->name << "/" << co->arity << "\n"
+         << "static VioValue* fn_" << i << "(VioValue* sp) {\n"
+         // each instruction pushes at most one value, and a native call two
+         << "  rt.reserve(sp, " << count + 2 << ");\n";
+    if (locals) {
+      // frames start at the args (main at the stack bottom)
+      out_ << "  auto bp = sp - " << co->arity << ";\n";
+    }
+
+    for (size_t offset = 0; offset < size; offset += opcodeSize(code[offset])) {
+      if (targets.count(offset) != 0) {
+        out_ << "L" << offset << ":\n";
+      }
+      instruction(co, offset);
+    }
+    // running off the end
+    if (targets.count(size) != 0) {
+      out_ << "L" << size << ":\n";
+    }
+    if (targets.count(size) != 0 ||
+        (last != OP_HALT && last != OP_RETURN && last != OP_JMP)) {
+      out_ << "  return sp;\n";
+    }
+    out_ << "}\n\n";
+  }
+
+  /**
+   * Statement of the instruction at `offset`.
+   */
+  void instruction(CodeObject* co, size_t offset) {
+    auto code = co->codeBegin();
+    auto opcode = code[offset];
+    auto operand = opcodeSize(opcode) > 1 ? code[offset + 1] : 0;
+    out_ << "  ";
+    switch (opcode) {
+      case OP_HALT:
+      case OP_RETURN:
+        out_ << "return sp;";
+        break;
+
+      case OP_CONST:
+        out_ << "*sp++ = " << constant(co, operand) << ";";
+        break;
+
+      case OP_ADD:
+      case OP_ADD_NUM:
+        out_ << "AOT_BINARY_OP(OP_ADD);";
+        break;
+      case OP_SUB:
+      case OP_SUB_NUM:
+        out_ << "AOT_BINARY_OP(OP_SUB);";
+        break;
+      case OP_MUL:
+      case OP_MUL_NUM:
+        out_ << "AOT_BINARY_OP(OP_MUL);";
+        break;
+      case OP_DIV:
+      case OP_DIV_NUM:
+        out_ << "AOT_BINARY_OP(OP_DIV);";
+        break;
+
+      case OP_COMPARE:
+      case OP_LT_NUM:
+      case OP_GT_NUM:
+      case OP_EQ_NUM:
+      case OP_GE_NUM:
+      case OP_LE_NUM:
+      case OP_NE_NUM: {
+        static const char* ops[] = {"<", ">", "==", ">=", "<=", "!="};
+        if (operand >= 6) {
+          DIE << "--emit-cpp: invalid compare operator " << (int)operand;
+        }
+        out_ << "AOT_COMPARE(" << ops[operand] << ", " << (int)operand
+             << ");";
+        break;
+      }
+
+      case OP_JMP_IF_FALSE:
+        out_ << "if (!(--sp)->boolean) goto L" << jumpTarget(code, offset)
+             << ";";
+        break;
+      case OP_JMP:
+        out_ << "goto L" << jumpTarget(code, offset) << ";";
+        break;
+
+      case OP_GET_GLOBAL:
+        out_ << "*sp++ = rt.globals[" << (int)operand << "].value;";
+        break;
+      case OP_SET_GLOBAL:
+        out_ << "rt.globals[" << (int)operand << "].value = sp[-1];";
+        break;
+
+      case OP_POP:
+        out_ << "sp--;";
+        break;
+
+      case OP_GET_LOCAL:
+        out_ << "*sp++ = bp[" << (int)operand << "];";
+        break;
+      case OP_SET_LOCAL:
+        out_ << "bp[" << (int)operand << "] = sp[-1];";
+        break;
+
+      case OP_SCOPE_EXIT:
+        // Move the result above the vars
+        out_ << "sp[-" << operand + 1 << "] = sp[-1]; sp -= "
+             << (int)operand << ";";
+        break;
+
+      case OP_CALL:
+        out_ << "sp = rt.call(sp, " << (int)operand << ");";
+        break;
+
+      case OP_CALL_DIRECT: {
+        auto& callee = co->constants.at(operand);
+        if (!IS_FUNCTION(callee)) {
+          DIE << "--emit-cpp: CALL_DIRECT of a non-function in " << co->name;
+        }
+        auto target = indices_.at(AS_FUNCTION(callee)->co);
+        out_ << "AOT_CALL_DIRECT(f" << target << ", "
+             << (int)code[offset + 2] << ", fn_" << target << ");";
+        break;
+      }
+
+      case OP_YIELD:
+      case OP_RESUME:
+        // C++ functions share the native stack
+        DIE << "--emit-cpp: fibers run in the interpreter only ("
+            << opcodeToString(opcode) << " in " << co->name << ")";
+
+      default:
+        DIE << "--emit-cpp: unknown opcode " << (int)opcode << " in "
+            << co->name;
+    }
+    out_ << "  // " << std::setw(4) << std::setfill('0') << offset << " "
+         << opcodeToString(opcode) << "\n";
+  }
+
+  /**
+   * Expression of constant `operand` of the code object: a literal
+   * for numbers and booleans.
+   */
+  std::string constant(CodeObject* co, uint8_t operand) {
+    if (operand >= co->constants.size()) {
+      DIE << "--emit-cpp: invalid constant " << (int)operand << " in "
+          << co->name;
+    }
+    auto& value = co->constants[operand];
+    if (IS_NUMBER(value)) {
+      return "NUMBER(" + number(AS_NUMBER(value)) + ")";
+    }
+    if (IS_INTEGER(value)) {
+      return AS_INTEGER(value) == INT64_MIN
+                 ? "INTEGER(INT64_MIN)"
+                 : "INTEGER((int64_t)" + std::to_string(AS_INTEGER(value)) +
+                       "LL)";
+    }
+    if (IS_BOOLEAN(value)) {
+      return AS_BOOLEAN(value) ? "BOOLEAN(true)" : "BOOLEAN(false)";
+    }
+    if (IS_STRING(value)) {
+      return "k" + std::to_string(indices_.at(co)) + "[" +
+             std::to_string(operand) + "]";
+    }
+    if (IS_FUNCTION(value)) {
+      return "f" + std::to_string(indices_.at(AS_FUNCTION(value)->co));
+    }
+    return "VioAotRuntime::code(f" +
+           std::to_string(indices_.at(AS_CODE(value))) + ")";
+  }
+
+  /**
+   * Allocates the functions and strings, and defines the globals.
+   */
+  void init(Global& global) {
+    out_ << "static void init() {\n"
+         << "  rt.defineGlobals({";
+    for (size_t i = 0; i < global.globals.size(); i++) {
+      out_ << (i > 0 ? ", " : "") << quote(global.globals[i].name);
+    }
+    out_ << "});\n";
+
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      auto co = codeObjects_[i];
+      out_ << "  f" << i << " = rt.function(" << quote(co->name) << ", "
+           << co->arity << ", fn_" << i << ");\n";
+    }
+    for (size_t i = 0; i < codeObjects_.size(); i++) {
+      auto& constants = codeObjects_[i]->constants;
+      for (size_t j = 0; j < constants.size(); j++) {
+        if (IS_STRING(constants[j])) {
+          out_ << "  k" << i << "[" << j << "] = ALLOC_STRING("
+               << quote(AS_CPPSTRING(constants[j])) << ");\n";
+        }
+      }
+    }
+    out_ << "}\n\n";
+  }
+
+  static bool hasStrings(CodeObject* co) {
+    for (auto& constant : co->constants) {
+      if (IS_STRING(constant)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Exact C++ literal of a number.
+   */
+  static std::string number(double value) {
+    if (std::isnan(value)) {
+      return "std::numeric_limits<double>::quiet_NaN()";
+    }
+    if (std::isinf(value)) {
+      return value > 0 ? "std::numeric_limits<double>::infinity()"
+                       : "-std::numeric_limits<double>::infinity()";
+    }
+    std::stringstream ss;
+    ss << std::hexfloat << value;
+    return ss.str();
+  }
+
+  /**
+   * C++ string literal.
+   */
+  static std::string quote(const std::string& value) {
+    std::stringstream ss;
+    ss << '"';
+    for (unsigned char c : value) {
+      if (c == '"' || c == '\\') {
+        ss << '\\' << c;
+      } else if (c < 0x20 || c >= 0x7f) {
+        ss << '\\' << std::oct << std::setw(3) << std::setfill('0') << (int)c
+           << std::dec;
+      } else {
+        ss << c;
+      }
+    }
+    ss << '"';
+    return ss.str();
+  }
+
+  /**
+   * Target offset of the jump at `offset`.
+   */
+  static size_t jumpTarget(const uint8_t* code, size_t offset) {
+    return (size_t)((code[offset + 1] << 8) | code[offset + 2]);
+  }
+
+  std::stringstream out_;
+
+  std::vector<CodeObject*> codeObjects_;
+  std::unordered_map<CodeObject*, size_t> indices_;
+};
+
+#endif
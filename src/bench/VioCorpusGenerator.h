@@ -0,0 +1,169 @@
+/**
+ * Synthetic corpus generator for benchmarks.
+ */
+
+#ifndef VioCorpusGenerator_h
+#define VioCorpusGenerator_h
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Logger.h"
+#include "../parser/VioParser.h"
+
+/**
+ * Generates synthetic S-expression programs of a given shape.
+ *
+ * All corpora are valid top-level programs (the caller wraps
+ * them into `(begin ...)` just like `VioVM::exec` does).
+ */
+class VioCorpusGenerator {
+ public:
+  /**
+   * Names of all supported corpus shapes.
+   */
+  static std::vector<std::string> shapes() {
+    return {"deep-nesting", "wide-list", "long-strings", "many-defs"};
+  }
+
+  /**
+   * Generates a corpus of the given shape, `size` controls its scale.
+   */
+  std::string generate(const std::string& shape, size_t size) {
+    if (shape == "deep-nesting") {
+      return deepNesting(size);
+    } else if (shape == "wide-list") {
+      return wideList(size);
+    } else if (shape == "long-strings") {
+      return longStrings(size);
+    } else if (shape == "many-defs") {
+      return manyDefs(size);
+    }
+    DIE << "VioCorpusGenerator: unknown shape: " << shape;
+    return "";
+  }
+
+  /**
+   * (+ 0 (+ 1 (+ 2 ... 0)))
+   */
+  std::string deepNesting(size_t depth) {
+    std::stringstream ss;
+    for (size_t i = 0; i < depth; i++) {
+      ss << "(+ " << i % 100 << " ";
+    }
+    ss << "0";
+    for (size_t i = 0; i < depth; i++) {
+      ss << ")";
+    }
+    ss << "\n";
+    return ss.str();
+  }
+
+  /**
+   * (def w0 () (begin 0 1 ... 199)) (def w1 () (begin 200 ...)) ...
+   *
+   * Lists of 200 distinct literals: constant indices are single bytes,
+   * so a function has at most 256 constants (and a program 128
+   * functions, each taking two constants of main).
+   */
+  std::string wideList(size_t width) {
+    const size_t perFunction = 200;
+    if (width > perFunction * 100) {
+      DIE << "VioCorpusGenerator: wide-list is at most "
+          << perFunction * 100 << " wide";
+    }
+    std::stringstream ss;
+    for (size_t i = 0; i < width; i++) {
+      if (i % perFunction == 0) {
+        ss << (i == 0 ? "" : ")) ") << "(def w" << i / perFunction
+           << " () (begin";
+      }
+      ss << " " << i;
+    }
+    if (width > 0) {
+      ss << "))";
+    }
+    ss << "\n";
+    return ss.str();
+  }
+
+  /**
+   * (var s0 "aaaa...") (var s1 "bbbb...") ...
+   */
+  std::string longStrings(size_t count) {
+    std::stringstream ss;
+    for (size_t i = 0; i < count; i++) {
+      ss << "(var s" << i << " \"" << std::string(256, 'a' + i % 26)
+         << "\")\n";
+    }
+    return ss.str();
+  }
+
+  /**
+   * (def f0 (x) (* x 0)) (def f1 (x) (* x 1)) ...
+   */
+  std::string manyDefs(size_t count) {
+    std::stringstream ss;
+    for (size_t i = 0; i < count; i++) {
+      ss << "(def f" << i << " (x y) (+ (* x " << i % 100 << ") y))\n";
+    }
+    return ss.str();
+  }
+
+  /**
+   * ASTs of programs with `count` distinct literals (0 "s1" 2 ...) in
+   * all: constant and global indices are single bytes, so the literals
+   * are spread over functions of 200 literals, 100 functions a program
+   * (each takes two constants of the program, its code and function):
+   *
+   *   (begin (def l0 () (begin 0 "s1" 2 ...)) (def l1 () ...) ...)
+   *
+   * Built directly (not parsed) so that large literal counts only
+   * exercise the compiler.
+   */
+  std::vector<Exp> literalsAsts(size_t count) {
+    const size_t perFunction = 200;
+    const size_t perProgram = 100;
+    std::string begin = "begin";
+    std::string def = "def";
+
+    std::vector<Exp> programs;
+    std::vector<Exp> program{Exp(begin)};
+    std::vector<Exp> body{Exp(begin)};
+    auto flushFunction = [&]() {
+      auto name = "l" + std::to_string(program.size() - 1);
+      program.push_back(Exp(std::vector<Exp>{
+          Exp(def), Exp(name), Exp(std::vector<Exp>{}), Exp(body)}));
+      body = {Exp(begin)};
+    };
+    auto flushProgram = [&]() {
+      programs.push_back(Exp(program));
+      program = {Exp(begin)};
+    };
+
+    for (size_t i = 0; i < count; i++) {
+      if (i % 4 == 1) {
+        std::string str = "\"s" + std::to_string(i) + "\"";
+        body.push_back(Exp(str));
+      } else {
+        body.push_back(Exp((int)i));
+      }
+      if (body.size() > perFunction) {
+        flushFunction();
+      }
+      if (program.size() > perProgram) {
+        flushProgram();
+      }
+    }
+    if (body.size() > 1) {
+      flushFunction();
+    }
+    if (program.size() > 1) {
+      flushProgram();
+    }
+    return programs;
+  }
+};
+
+#endif
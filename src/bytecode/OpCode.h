@@ -78,6 +78,45 @@
  */
 #define OP_RETURN 0x10
 
+/**
+ * Quickened math: specialized by the VM in place of OP_ADD, etc. once
+ * a site sees only numbers. Deoptimized back on a non-number operand.
+ */
+#define OP_ADD_NUM 0x11
+#define OP_SUB_NUM 0x12
+#define OP_MUL_NUM 0x13
+#define OP_DIV_NUM 0x14
+
+/**
+ * Quickened comparison, one per OP_COMPARE operator (in the same
+ * order, see `compareOps_`). The operator operand is kept to
+ * deoptimize back to OP_COMPARE.
+ */
+#define OP_LT_NUM 0x15
+#define OP_GT_NUM 0x16
+#define OP_EQ_NUM 0x17
+#define OP_GE_NUM 0x18
+#define OP_LE_NUM 0x19
+#define OP_NE_NUM 0x1A
+
+/**
+ * Direct call of a known global function: the callee constant and
+ * the argument count are encoded, no callee is pushed by the caller.
+ */
+#define OP_CALL_DIRECT 0x1B
+
+/**
+ * Suspends the running fiber, passing the value on the stack to the
+ * fiber which resumed it (or letting the scheduled fibers run).
+ */
+#define OP_YIELD 0x1C
+
+/**
+ * Resumes the fiber below the value on the stack with that value,
+ * until it yields or returns.
+ */
+#define OP_RESUME 0x1D
+
 #define OP_STR(op)  \
   case OP_##op:     \
     return #op
@@ -101,6 +140,19 @@ std::string opcodeToString(uint8_t opcode) {
     OP_STR(SCOPE_EXIT);
     OP_STR(CALL);
     OP_STR(RETURN);
+    OP_STR(ADD_NUM);
+    OP_STR(SUB_NUM);
+    OP_STR(MUL_NUM);
+    OP_STR(DIV_NUM);
+    OP_STR(LT_NUM);
+    OP_STR(GT_NUM);
+    OP_STR(EQ_NUM);
+    OP_STR(GE_NUM);
+    OP_STR(LE_NUM);
+    OP_STR(NE_NUM);
+    OP_STR(CALL_DIRECT);
+    OP_STR(YIELD);
+    OP_STR(RESUME);
 
     default:
       DIE << "opcodeToString: unkown opcode: " << std::hex << (int)opcode;
@@ -108,4 +160,33 @@ std::string opcodeToString(uint8_t opcode) {
   return "Unknown";
 }
 
+/**
+ * Instruction size in bytes (opcode and operands).
+ */
+size_t opcodeSize(uint8_t opcode) {
+  switch (opcode) {
+    case OP_CONST:
+    case OP_COMPARE:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SCOPE_EXIT:
+    case OP_CALL:
+    case OP_LT_NUM:
+    case OP_GT_NUM:
+    case OP_EQ_NUM:
+    case OP_GE_NUM:
+    case OP_LE_NUM:
+    case OP_NE_NUM:
+      return 2;
+    case OP_JMP_IF_FALSE:
+    case OP_JMP:
+    case OP_CALL_DIRECT:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
 #endif
\ No newline at end of file
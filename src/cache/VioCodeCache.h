@@ -0,0 +1,110 @@
+/**
+ * Vio bytecode cache.
+ */
+
+#ifndef VioCodeCache_h
+#define VioCodeCache_h
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "VioImage.h"
+
+/**
+ * Persistent cache of compiled programs (.vioc files).
+ *
+ * A cache file is a bytecode image (see VioImage) of the program,
+ * named by a content hash of the source. A warm run maps the image
+ * and executes it in place, without parsing and compiling.
+ */
+class VioCodeCache {
+ public:
+  VioCodeCache(const std::string& directory) : directory_(directory) {}
+
+  /**
+   * Cache key: FNV-1a hash of the source, and the optimization
+   * level it is compiled with.
+   */
+  static uint64_t key(const std::string& source, int optLevel) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : source) {
+      hash = (hash ^ c) * 1099511628211ull;
+    }
+    return (hash ^ (uint64_t)optLevel) * 1099511628211ull;
+  }
+
+  /**
+   * Cache file of a key.
+   */
+  std::string path(uint64_t key) {
+    std::stringstream ss;
+    ss << std::hex << std::setfill('0') << std::setw(16) << key << ".vioc";
+    return (std::filesystem::path(directory_) / ss.str()).string();
+  }
+
+  /**
+   * Stores the program of the `main` entry function. Returns false
+   * if it can't be cached or written.
+   */
+  bool store(uint64_t key, FunctionObject* main, Global& global) {
+    auto image = VioImageWriter().write(key, main, global);
+    if (image.empty()) {
+      return false;
+    }
+
+    // Write to a temporary file and rename, so concurrent
+    // runs never see a partial file.
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    auto file = path(key);
+    auto tmp = file + ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream stream(tmp, std::ios::binary);
+      stream.write(image.data(), image.size());
+      if (!stream) {
+        std::filesystem::remove(tmp, error);
+        return false;
+      }
+    }
+    std::filesystem::rename(tmp, file, error);
+    return !error;
+  }
+
+  /**
+   * Maps the program of a key: defines its globals, appends its code
+   * objects to `codeObjects` and returns the entry function.
+   * Returns nullptr on a miss, or a stale or corrupt file.
+   */
+  FunctionObject* load(uint64_t key, Global& global,
+                       std::vector<CodeObject*>& codeObjects) {
+    auto image = std::make_unique<VioImage>();
+    if (!image->map(path(key), key)) {
+      return nullptr;
+    }
+    auto entry = image->load(global, codeObjects);
+    if (entry != nullptr) {
+      images_.push_back(std::move(image));
+    }
+    return entry;
+  }
+
+ private:
+  /**
+   * Directory of the cache files.
+   */
+  std::string directory_;
+
+  /**
+   * Mapped images, code objects loaded from them execute in place.
+   */
+  std::vector<std::unique_ptr<VioImage>> images_;
+};
+
+#endif
@@ -0,0 +1,506 @@
+/**
+ * Vio bytecode images.
+ */
+
+#ifndef VioImage_h
+#define VioImage_h
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Logger.h"
+#include "../vm/VioValue.h"
+#include "../vm/Global.h"
+
+/**
+ * Image magic.
+ */
+#define VIO_IMAGE_MAGIC "VIOI"
+
+/**
+ * Image format version. Bump on any change of the format,
+ * the instruction set, or the compiler output.
+ */
+#define VIO_IMAGE_VERSION 4
+
+/**
+ * Position-independent bytecode image.
+ *
+ * All references are byte offsets from the start of the image, so
+ * it can be mapped at any address and used without relocation:
+ *
+ *   ImageHeader
+ *   u32[globalsCount]          offsets of global names
+ *   ImageCode[codeCount]       code object table
+ *   ImageConst[], ImageLocal[] per code object
+ *   code bytes, strings        (string: u32 length, bytes)
+ *
+ * Tables are 8-byte aligned. Numbers are in the host byte order.
+ */
+struct ImageHeader {
+  char magic[4];
+  uint32_t version;
+
+  /**
+   * Key of the source the image was built from (see VioCodeCache).
+   */
+  uint64_t key;
+
+  uint32_t size;
+  uint32_t globalsCount;
+  uint32_t globals;
+  uint32_t codeCount;
+  uint32_t codeObjects;
+  uint32_t main;
+};
+
+struct ImageCode {
+  uint32_t name;
+  uint32_t arity;
+  uint32_t code;
+  uint32_t codeSize;
+  uint32_t constants;
+  uint32_t constantsCount;
+  uint32_t locals;
+  uint32_t localsCount;
+};
+
+/**
+ * Constant tags in an image.
+ */
+enum class ImageConstTag : uint32_t {
+  NUMBER,
+  BOOLEAN,
+  STRING,
+  CODE,
+  FUNCTION,
+  INTEGER,
+};
+
+struct ImageConst {
+  ImageConstTag tag;
+
+  /**
+   * Boolean value, string offset or code object index.
+   */
+  uint32_t value;
+
+  union {
+    double number;
+    int64_t integer;
+  };
+};
+
+struct ImageLocal {
+  uint32_t name;
+  uint32_t scopeLevel;
+  uint32_t slot;
+};
+
+// ----------------------------------------------------------------
+
+/**
+ * Code objects reachable from `roots` through code and function
+ * constants, the roots first (`main` is the first one). Lazily loaded
+ * constants are resolved. Returns false if some constant can't be
+ * stored in an image (e.g. a native function).
+ */
+bool reachableCodeObjects(const std::vector<CodeObject*>& roots,
+                          std::vector<CodeObject*>& result,
+                          std::unordered_map<CodeObject*, size_t>& indices) {
+  result.clear();
+  indices.clear();
+  for (auto root : roots) {
+    if (indices.count(root) == 0) {
+      indices[root] = result.size();
+      result.push_back(root);
+    }
+  }
+
+  for (size_t i = 0; i < result.size(); i++) {
+    result[i]->resolve();
+    for (auto& constant : result[i]->constants) {
+      CodeObject* co = nullptr;
+      if (IS_CODE(constant)) {
+        co = AS_CODE(constant);
+      } else if (IS_FUNCTION(constant)) {
+        co = AS_FUNCTION(constant)->co;
+      } else if (IS_OBJECT(constant) && !IS_STRING(constant)) {
+        return false;
+      }
+      if (co != nullptr && indices.count(co) == 0) {
+        indices[co] = result.size();
+        result.push_back(co);
+      }
+    }
+  }
+  return true;
+}
+
+bool reachableCodeObjects(CodeObject* main, std::vector<CodeObject*>& result,
+                          std::unordered_map<CodeObject*, size_t>& indices) {
+  return reachableCodeObjects(std::vector<CodeObject*>{main}, result, indices);
+}
+
+/**
+ * Builds images of compiled programs.
+ */
+class VioImageWriter {
+ public:
+  /**
+   * Returns the image of the program of the `main` entry function,
+   * or an empty string if it can't be stored.
+   */
+  std::string write(uint64_t key, FunctionObject* main, Global& global) {
+    return write(key, {main->co}, global);
+  }
+
+  /**
+   * Image of the code objects reachable from `roots`, in the order of
+   * reachableCodeObjects, the first root as the entry.
+   */
+  std::string write(uint64_t key, const std::vector<CodeObject*>& roots,
+                    Global& global) {
+    std::vector<CodeObject*> codeObjects;
+    std::unordered_map<CodeObject*, size_t> indices;
+    if (!reachableCodeObjects(roots, codeObjects, indices)) {
+      return "";
+    }
+
+    out_.clear();
+    strings_.clear();
+
+    ImageHeader header{};
+    std::memcpy(header.magic, VIO_IMAGE_MAGIC, 4);
+    header.version = VIO_IMAGE_VERSION;
+    header.key = key;
+    header.main = 0;
+    reserve(sizeof(ImageHeader));
+
+    // Tables first, their contents are patched below.
+    header.globalsCount = global.globals.size();
+    header.globals = reserve(sizeof(uint32_t) * header.globalsCount);
+    header.codeCount = codeObjects.size();
+    header.codeObjects = reserve(sizeof(ImageCode) * header.codeCount);
+
+    std::vector<ImageCode> table(codeObjects.size());
+    for (size_t i = 0; i < codeObjects.size(); i++) {
+      auto co = codeObjects[i];
+      auto& entry = table[i];
+      entry.arity = co->arity;
+      entry.constantsCount = co->constants.size();
+      entry.constants = reserve(sizeof(ImageConst) * entry.constantsCount);
+      entry.localsCount = co->locals.size();
+      entry.locals = reserve(sizeof(ImageLocal) * entry.localsCount);
+    }
+
+    for (size_t i = 0; i < codeObjects.size(); i++) {
+      auto co = codeObjects[i];
+      auto& entry = table[i];
+      entry.name = string(co->name);
+      entry.codeSize = co->codeSize();
+      entry.code = append(co->codeBegin(), entry.codeSize);
+
+      for (size_t j = 0; j < co->constants.size(); j++) {
+        auto& constant = co->constants[j];
+        ImageConst value{};
+        if (IS_NUMBER(constant)) {
+          value.tag = ImageConstTag::NUMBER;
+          value.number = AS_NUMBER(constant);
+        } else if (IS_INTEGER(constant)) {
+          value.tag = ImageConstTag::INTEGER;
+          value.integer = AS_INTEGER(constant);
+        } else if (IS_BOOLEAN(constant)) {
+          value.tag = ImageConstTag::BOOLEAN;
+          value.value = AS_BOOLEAN(constant);
+        } else if (IS_STRING(constant)) {
+          value.tag = ImageConstTag::STRING;
+          value.value = string(AS_CPPSTRING(constant));
+        } else if (IS_CODE(constant)) {
+          value.tag = ImageConstTag::CODE;
+          value.value = indices.at(AS_CODE(constant));
+        } else {
+          value.tag = ImageConstTag::FUNCTION;
+          value.value = indices.at(AS_FUNCTION(constant)->co);
+        }
+        patch(entry.constants + j * sizeof(ImageConst), value);
+      }
+
+      for (size_t j = 0; j < co->locals.size(); j++) {
+        auto& local = co->locals[j];
+        ImageLocal value{string(local.name), (uint32_t)local.scopeLevel,
+                         (uint32_t)local.slot};
+        patch(entry.locals + j * sizeof(ImageLocal), value);
+      }
+    }
+
+    for (size_t i = 0; i < table.size(); i++) {
+      patch(header.codeObjects + i * sizeof(ImageCode), table[i]);
+    }
+    for (size_t i = 0; i < global.globals.size(); i++) {
+      patch(header.globals + i * sizeof(uint32_t),
+            string(global.globals[i].name));
+    }
+
+    if (out_.size() > UINT32_MAX) {
+      return "";
+    }
+    header.size = out_.size();
+    patch(0, header);
+    return out_;
+  }
+
+ private:
+  /**
+   * Appends zeroed, 8-byte aligned space, returns its offset.
+   */
+  uint32_t reserve(size_t size) {
+    out_.resize((out_.size() + 7) & ~(size_t)7, '\0');
+    auto offset = out_.size();
+    out_.resize(offset + size, '\0');
+    return offset;
+  }
+
+  uint32_t append(const void* data, size_t size) {
+    auto offset = reserve(size);
+    std::memcpy(&out_[offset], data, size);
+    return offset;
+  }
+
+  /**
+   * Appends a string (deduplicated), returns its offset.
+   */
+  uint32_t string(const std::string& value) {
+    auto it = strings_.find(value);
+    if (it != strings_.end()) {
+      return it->second;
+    }
+    uint32_t length = value.size();
+    auto offset = append(&length, sizeof(length));
+    out_.append(value);
+    strings_[value] = offset;
+    return offset;
+  }
+
+  template <typename T>
+  void patch(size_t offset, const T& value) {
+    std::memcpy(&out_[offset], &value, sizeof(T));
+  }
+
+  std::string out_;
+
+  /**
+   * Offsets of strings already in the image.
+   */
+  std::unordered_map<std::string, uint32_t> strings_;
+};
+
+// ----------------------------------------------------------------
+
+/**
+ * Memory-mapped bytecode image.
+ *
+ * The file is mapped privately (copy-on-write): code objects execute
+ * their code directly from the mapping, and quickening only copies the
+ * pages it rewrites, so processes running the same image share the
+ * page cache. Constants and locals of a code object are resolved from
+ * their offsets on its first use (see CodeObject::resolve).
+ *
+ * The image must outlive the code objects loaded from it.
+ */
+class VioImage {
+ public:
+  ~VioImage() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  /**
+   * Maps an image file. Returns false if it's missing or invalid,
+   * or was built from another key.
+   */
+  bool map(const std::string& path, uint64_t key) {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return false;
+    }
+    auto mapped = map(fd, key);
+    close(fd);
+    return mapped;
+  }
+
+  /**
+   * Maps an image from an open file (kept open by the caller).
+   */
+  bool map(int fd, uint64_t key) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+      return false;
+    }
+    size_ = st.st_size;
+    auto data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    data_ = (uint8_t*)data;
+
+    auto header = at<ImageHeader>(0);
+    return std::memcmp(header->magic, VIO_IMAGE_MAGIC, 4) == 0 &&
+           header->version == VIO_IMAGE_VERSION && header->key == key &&
+           header->size == size_ &&
+           inBounds(header->globals,
+                    (size_t)header->globalsCount * sizeof(uint32_t)) &&
+           inBounds(header->codeObjects,
+                    (size_t)header->codeCount * sizeof(ImageCode)) &&
+           header->main < header->codeCount && validateCodeObjects();
+  }
+
+  /**
+   * Defines the image's globals, appends its code objects (with
+   * unresolved constants) to `codeObjects`, and returns the entry
+   * function. Returns nullptr if the globals of the VM are not
+   * a prefix of the image's.
+   */
+  FunctionObject* load(Global& global, std::vector<CodeObject*>& codeObjects) {
+    auto header = at<ImageHeader>(0);
+    auto names = at<uint32_t>(header->globals);
+
+    if (header->globalsCount < global.globals.size()) {
+      return nullptr;
+    }
+    for (size_t i = 0; i < header->globalsCount; i++) {
+      if (!validString(names[i]) ||
+          (i < global.globals.size() && global.globals[i].name != string(names[i]))) {
+        return nullptr;
+      }
+    }
+    for (size_t i = global.globals.size(); i < header->globalsCount; i++) {
+      global.define(string(names[i]));
+    }
+
+    auto table = at<ImageCode>(header->codeObjects);
+    codeObjects_.resize(header->codeCount);
+    for (size_t i = 0; i < header->codeCount; i++) {
+      auto& entry = table[i];
+      auto co = AS_CODE(ALLOC_CODE(string(entry.name), entry.arity));
+      co->mappedCode = data_ + entry.code;
+      co->mappedCodeSize = entry.codeSize;
+      co->resolver = [this, i](CodeObject* co) { resolve(co, i); };
+      codeObjects_[i] = co;
+    }
+
+    codeObjects.insert(codeObjects.end(), codeObjects_.begin(),
+                       codeObjects_.end());
+    return AS_FUNCTION(ALLOC_FUNCTION(codeObjects_[header->main]));
+  }
+
+ private:
+  /**
+   * Resolves constants and locals of the code object `index`.
+   */
+  void resolve(CodeObject* co, size_t index) {
+    auto& entry = at<ImageCode>(at<ImageHeader>(0)->codeObjects)[index];
+
+    auto constants = at<ImageConst>(entry.constants);
+    co->constants.resize(entry.constantsCount);
+    for (size_t i = 0; i < entry.constantsCount; i++) {
+      auto& constant = constants[i];
+      switch (constant.tag) {
+        case ImageConstTag::NUMBER:
+          co->constants[i] = NUMBER(constant.number);
+          break;
+        case ImageConstTag::INTEGER:
+          co->constants[i] = INTEGER(constant.integer);
+          break;
+        case ImageConstTag::BOOLEAN:
+          co->constants[i] = BOOLEAN(constant.value != 0);
+          break;
+        case ImageConstTag::STRING:
+          if (!validString(constant.value)) {
+            DIE << "[VioImage]: invalid string constant in " << co->name;
+          }
+          co->constants[i] = ALLOC_STRING(string(constant.value));
+          break;
+        case ImageConstTag::CODE:
+        case ImageConstTag::FUNCTION: {
+          if (constant.value >= codeObjects_.size()) {
+            DIE << "[VioImage]: invalid code constant in " << co->name;
+          }
+          auto target = codeObjects_[constant.value];
+          co->constants[i] =
+              constant.tag == ImageConstTag::CODE
+                  ? (VioValue){VioValueType::OBJECT, .object = (Object*)target}
+                  : ALLOC_FUNCTION(target);
+          break;
+        }
+        default:
+          DIE << "[VioImage]: invalid constant in " << co->name;
+      }
+    }
+
+    auto locals = at<ImageLocal>(entry.locals);
+    for (size_t i = 0; i < entry.localsCount; i++) {
+      if (!validString(locals[i].name)) {
+        DIE << "[VioImage]: invalid local in " << co->name;
+      }
+      co->locals.push_back(
+          {string(locals[i].name), locals[i].scopeLevel, locals[i].slot});
+    }
+  }
+
+  /**
+   * Checks that code object tables are within the image.
+   */
+  bool validateCodeObjects() {
+    auto header = at<ImageHeader>(0);
+    auto table = at<ImageCode>(header->codeObjects);
+    for (size_t i = 0; i < header->codeCount; i++) {
+      auto& entry = table[i];
+      if (!validString(entry.name) || !inBounds(entry.code, entry.codeSize) ||
+          !inBounds(entry.constants,
+                    (size_t)entry.constantsCount * sizeof(ImageConst)) ||
+          !inBounds(entry.locals,
+                    (size_t)entry.localsCount * sizeof(ImageLocal))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool inBounds(size_t offset, size_t size) {
+    return offset <= size_ && size <= size_ - offset;
+  }
+
+  bool validString(uint32_t offset) {
+    return inBounds(offset, sizeof(uint32_t)) &&
+           inBounds(offset + sizeof(uint32_t), *at<uint32_t>(offset));
+  }
+
+  std::string string(uint32_t offset) {
+    return std::string((const char*)data_ + offset + sizeof(uint32_t),
+                       *at<uint32_t>(offset));
+  }
+
+  template <typename T>
+  T* at(size_t offset) {
+    return (T*)(data_ + offset);
+  }
+
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+
+  /**
+   * Code objects by their index in the image.
+   */
+  std::vector<CodeObject*> codeObjects_;
+};
+
+#endif
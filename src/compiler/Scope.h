@@ -0,0 +1,117 @@
+/**
+ * Scope analysis.
+ */
+
+#ifndef Scope_h
+#define Scope_h
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * Scope type.
+ */
+enum class ScopeType {
+  GLOBAL,
+  FUNCTION,
+  BLOCK,
+};
+
+/**
+ * Allocation type.
+ */
+enum class AllocType {
+  GLOBAL,
+  LOCAL,
+  CELL,
+};
+
+/**
+ * Scope structure.
+ *
+ * Built by the compiler's analysis pass for each block and function,
+ * then used during codegen to resolve names without scanning locals.
+ */
+struct Scope {
+  Scope(ScopeType type, std::shared_ptr<Scope> parent)
+      : type(type), parent(parent) {}
+
+  /**
+   * Registers a declaration in this scope.
+   */
+  void addLocal(const std::string& name) {
+    allocInfo[name] =
+        type == ScopeType::GLOBAL ? AllocType::GLOBAL : AllocType::LOCAL;
+  }
+
+  /**
+   * Whether the name is declared in this scope.
+   */
+  bool declares(const std::string& name) { return allocInfo.count(name) != 0; }
+
+  /**
+   * Analyzes a reference: finds the declaring scope, and if the
+   * reference crosses a function boundary to a non-global scope,
+   * records it as a free variable (to be captured in a cell).
+   */
+  void maybePromote(const std::string& name) {
+    bool crossesFunction = false;
+    auto scope = this;
+
+    while (scope != nullptr) {
+      if (scope->declares(name)) {
+        if (crossesFunction && scope->allocInfo[name] == AllocType::LOCAL) {
+          scope->allocInfo[name] = AllocType::CELL;
+          scope->cells.insert(name);
+        }
+        return;
+      }
+      if (scope->type == ScopeType::FUNCTION) {
+        crossesFunction = true;
+      }
+      scope = scope->parent.get();
+    }
+  }
+
+  /**
+   * Binds a declared local to its stack slot (set during codegen).
+   */
+  void setSlot(const std::string& name, int slot) { slots[name] = slot; }
+
+  /**
+   * Returns the stack slot of a local declared in this scope, or -1.
+   */
+  int getSlot(const std::string& name) {
+    auto it = slots.find(name);
+    return it == slots.end() ? -1 : it->second;
+  }
+
+  /**
+   * Scope type.
+   */
+  ScopeType type;
+
+  /**
+   * Parent scope.
+   */
+  std::shared_ptr<Scope> parent;
+
+  /**
+   * Allocation info of the declared names.
+   */
+  std::unordered_map<std::string, AllocType> allocInfo;
+
+  /**
+   * Stack slots of the locals already emitted.
+   */
+  std::unordered_map<std::string, int> slots;
+
+  /**
+   * Free variables referenced from inner functions.
+   */
+  std::unordered_set<std::string> cells;
+};
+
+#endif
@@ -8,25 +8,28 @@
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../disassembler/VioDisassembler.h"
+#include "../ir/VioPassManager.h"
+#include "Scope.h"
+#include "VioConstantFolder.h"
+#include "VioInliner.h"
 #include "../parser/VioParser.h"
 #include "../vm/VioValue.h"
 #include "../vm/Global.h"
 
 // -----------------------------------------------------------------
-// Allocates new constants in the pool
-#define ALLOC_CONST(tester, converter, allocator, value)  \
+// Allocates new constants in the pool, deduplicated via a hash index
+#define ALLOC_CONST(index, allocator, value)              \
     do {                                                  \
-      for (auto i = 0; i < co->constants.size(); i++) {   \
-        if (!tester(co->constants[i])){                   \
-          continue;                                       \
-        }                                                 \
-        if (converter(co->constants[i]) == value) {       \
-          return i;                                       \
-        }                                                 \
+      auto it = co->index.find(value);                    \
+      if (it != co->index.end()) {                        \
+        return it->second;                                \
       }                                                   \
       co->constants.push_back(allocator(value));          \
+      co->index[value] = co->constants.size() - 1;        \
       return co->constants.size() - 1;                    \
     } while (false)
 
@@ -52,7 +55,37 @@ class VioCompiler {
   //     : global(global),
   //       disassembler(std::make_unique<VioDisassembler>(global)) {}
   VioCompiler(std::shared_ptr<Global> global) 
-    : global(global), disassembler(std::make_unique<VioDisassembler>(global)) {}
+    : global(global), disassembler(std::make_unique<VioDisassembler>(global)) {
+    setOptimizationLevel(OptLevel::O1);
+  }
+
+  /**
+   * Sets the optimization level and rebuilds the pass pipeline.
+   */
+  void setOptimizationLevel(OptLevel level) {
+    optLevel_ = level;
+    passManager_.buildPipeline(level);
+  }
+
+  /**
+   * Compiles programs as snippets of a session: later snippets may
+   * reassign globals and redefine functions, so globals are neither
+   * propagated nor inlined.
+   */
+  void setIncremental(bool enabled) {
+    incremental_ = enabled;
+    constantFolder_.setPropagateGlobals(!enabled);
+  }
+
+  /**
+   * Current optimization level.
+   */
+  OptLevel getOptimizationLevel() { return optLevel_; }
+
+  /**
+   * Pass manager, extra passes can be added to the pipeline.
+   */
+  VioPassManager& getPassManager() { return passManager_; }
 
   /**
    * Main compile API.
@@ -62,16 +95,103 @@ class VioCompiler {
     // allocate the new code object
     // co = AS_CODE(ALLOC_CODE("main", exp.list.size()));
     // , exp.list.size())
+    auto firstCodeObject = codeObjects_.size();
     co = AS_CODE(createCodeObjectValue("main"));
     // co = AS_CODE(ALLOC_CODE("main"));
     main = AS_FUNCTION(ALLOC_FUNCTION(co));
+    // fold constant subexpressions before codegen
+    auto optimized = optLevel_ >= OptLevel::O2 && !incremental_
+                         ? inliner_.inlineCalls(exp)
+                         : exp;
+    if (optLevel_ >= OptLevel::O1) {
+      optimized = constantFolder_.fold(optimized);
+    }
+    // global functions which can be called directly
+    declCounts_.clear();
+    assignedNames_.clear();
+    directCallees_.clear();
+    if (optLevel_ >= OptLevel::O1 && !incremental_) {
+      collectAssignments(optimized);
+    }
+    // resolve scopes of all blocks and functions
+    scopeInfo_.clear();
+    selfFunctions_.clear();
+    analyze(optimized, nullptr);
     // generate recursively from top-level
-    gen(exp);
+    gen(optimized);
 
     emit(OP_HALT);
+
+    // run the IR pipeline on all code objects of this unit
+    for (auto i = firstCodeObject; i < codeObjects_.size(); i++) {
+      passManager_.run(codeObjects_[i]);
+    }
     // return co;
   }
 
+  /**
+   * Scope analysis: creates a scope per block and function,
+   * registers declarations and marks free variables.
+   */
+  void analyze(const Exp& exp, std::shared_ptr<Scope> scope) {
+    if (exp.type == ExpType::SYMBOL) {
+      if (scope != nullptr && exp.string != "true" && exp.string != "false") {
+        scope->maybePromote(exp.string);
+      }
+      return;
+    }
+
+    if (exp.type != ExpType::LIST || exp.list.empty()) {
+      return;
+    }
+
+    auto tag = exp.list[0];
+
+    if (tag.type == ExpType::SYMBOL) {
+      auto op = tag.string;
+
+      if (op == "begin") {
+        auto newScope = std::make_shared<Scope>(
+            scope == nullptr ? ScopeType::GLOBAL : ScopeType::BLOCK, scope);
+        scopeInfo_[&exp] = newScope;
+        for (auto i = 1; i < exp.list.size(); i++) {
+          analyze(exp.list[i], newScope);
+        }
+        return;
+      }
+
+      if (op == "var") {
+        scope->addLocal(exp.list[1].string);
+        analyze(exp.list[2], scope);
+        return;
+      }
+
+      if (op == "set") {
+        scope->maybePromote(exp.list[1].string);
+        analyze(exp.list[2], scope);
+        return;
+      }
+
+      if (op == "def") {
+        auto fnName = exp.list[1].string;
+        scope->addLocal(fnName);
+
+        auto fnScope = std::make_shared<Scope>(ScopeType::FUNCTION, scope);
+        scopeInfo_[&exp] = fnScope;
+
+        for (auto& param : exp.list[2].list) {
+          fnScope->addLocal(param.string);
+        }
+        analyze(exp.list[3], fnScope);
+        return;
+      }
+    }
+
+    for (auto& e : exp.list) {
+      analyze(e, scope);
+    }
+  }
+
   /**
    * Main compile loop.
    */
@@ -83,7 +203,7 @@ class VioCompiler {
        */
       case ExpType::NUMBER:
         emit(OP_CONST);
-        emit(numericConstIdx(exp.number));
+        emitConstIndex(integerConstIdx(exp.number));
         break;
 
       /**
@@ -92,7 +212,7 @@ class VioCompiler {
        */
       case ExpType::STRING:
         emit(OP_CONST);
-        emit(stringConstIdx(exp.string));
+        emitConstIndex(stringConstIdx(exp.string));
         break;
 
       /**
@@ -105,23 +225,29 @@ class VioCompiler {
          */
         if (exp.string == "true" || exp.string == "false") {
           emit(OP_CONST);
-          emit(booleanConstIdx(exp.string == "true" ? true : false));
+          emitConstIndex(booleanConstIdx(exp.string == "true" ? true : false));
         } else {
             // Variables:
             auto varName = exp.string;
             // 1. Local vars:
-            auto localIndex = co->getLocalIndex(varName);
+            auto localIndex = resolveLocal(varName);
             if (localIndex != -1) {
               emit(OP_GET_LOCAL);
               emit(localIndex);
             }
-            // 2. Global vars
+            // 2. The function's own name
+            else if (auto self = resolveSelf(varName)) {
+              emit(OP_CONST);
+              emitConstIndex(functionConstIdx(self));
+            }
+            // 3. Global vars
             else {
-              if (!global->exists(varName)) {
+              auto globalIndex = global->getGlobalIndex(varName);
+              if (globalIndex == -1) {
                 DIE << "[VioCompiler]: Reference error: " << varName;
                 }
               emit(OP_GET_GLOBAL);
-              emit(global->getGlobalIndex(varName));
+              emitGlobalIndex(globalIndex, varName);
          }
        }
           break;
@@ -161,9 +287,21 @@ class VioCompiler {
            gen(exp.list[1]);
            gen(exp.list[2]);
            emit(OP_COMPARE);
-           emit(compareOps_[op]);
+           emit(compareOps_.at(op));
          }
          
+        // fibers
+        else if (op == "yield") {
+          gen(exp.list[1]);
+          emit(OP_YIELD);
+        }
+
+        else if (op == "resume") {
+          gen(exp.list[1]);
+          gen(exp.list[2]);
+          emit(OP_RESUME);
+        }
+
         else if (op == "if") {
            // emit test
            gen(exp.list[1]);
@@ -175,6 +313,7 @@ class VioCompiler {
            emit(0);
 
            auto elseJmpAddr = getOffset() - 2;
+           auto branchDepth = co->stackDepth;
 
            gen(exp.list[2]);
 
@@ -187,10 +326,14 @@ class VioCompiler {
            // Patch else branch address
            auto elseBranchAddr = getOffset();
            patchJumpAddress(elseJmpAddr, elseBranchAddr);
+           co->stackDepth = branchDepth;
 
-           // emit <alternate> if exist
+           // emit <alternate> if exist, otherwise the `if` evaluates to false
            if (exp.list.size() == 4) {
              gen(exp.list[3]);
+           } else {
+             emit(OP_CONST);
+             emitConstIndex(booleanConstIdx(false));
            }
 
            // patch the end
@@ -208,15 +351,23 @@ class VioCompiler {
           emit(0);
 
           auto lookEndJmpAddr = getOffset() - 2;
+          auto loopDepth = co->stackDepth;
 
+          // the body value is discarded on each iteration
           gen(exp.list[2]);
+          emit(OP_POP);
           emit(OP_JMP);
           emit(0);
           emit(0);
 
           patchJumpAddress(getOffset() - 2, loopStartAddr);
-          auto loopEndAddr = getOffset() + 1;
+          auto loopEndAddr = getOffset();
           patchJumpAddress(lookEndJmpAddr, loopEndAddr);
+          co->stackDepth = loopDepth;
+
+          // the loop evaluates to the last (false) test result
+          emit(OP_CONST);
+          emitConstIndex(booleanConstIdx(false));
 
         }
 
@@ -229,13 +380,12 @@ class VioCompiler {
             if (isGlobalScope()) {
             global->define(varName);
             emit(OP_SET_GLOBAL);
-            emit(global->getGlobalIndex(varName));
+            emitGlobalIndex(global->getGlobalIndex(varName), varName);
             }
             // 2. Local vars
             else{
-              co->addLocal(varName);
               emit(OP_SET_LOCAL);
-              emit(co->getLocalIndex(varName));
+              emit(declareLocal(varName, co->stackDepth - 1));
             }
         }
 
@@ -245,7 +395,7 @@ class VioCompiler {
           gen(exp.list[2]);
 
            // For local variables
-           auto localIndex = co->getLocalIndex(varName);
+           auto localIndex = resolveLocal(varName);
 
            if (localIndex != -1) {
              emit(OP_SET_LOCAL);
@@ -257,12 +407,13 @@ class VioCompiler {
               DIE << "Reference error: " << varName << " is not defined.";
             }
             emit(OP_SET_GLOBAL);
-            emit(globalIndex);
+            emitGlobalIndex(globalIndex, varName);
            }
           }
 
         else if (op == "begin") {
           scopeEnter();
+          scopeStack_.push_back(scopeInfo_.at(&exp));
           // compile each expression within the block:
           for (auto i=1; i < exp.list.size(); i++) {
             // the value of the last expression is kept on the stack as final result
@@ -278,12 +429,14 @@ class VioCompiler {
              }
           }
           scopeExit();
+          scopeStack_.pop_back();
           }
         
         else if (op=="def") {
           auto fnName = exp.list[1].string;
           auto params = exp.list[2].list;
           auto arity = params.size();
+          auto isGlobal = isGlobalScope();
 
           // compileFunction(
           //   exp,
@@ -294,45 +447,62 @@ class VioCompiler {
           auto prevCo = co;
           auto coValue = createCodeObjectValue(fnName, arity);
           co = AS_CODE(coValue);
+          auto fn = ALLOC_FUNCTION(co);
+          // allocated before the body, so recursive calls can be direct
+          if (isGlobal && declCounts_[fnName] == 1 &&
+              assignedNames_.count(fnName) == 0) {
+            directCallees_[fnName] = AS_FUNCTION(fn);
+          }
 
           prevCo->constants.push_back(coValue); // store as a new constant
-          co->addLocal(fnName); //register function name as local variable to enable calling recursively
-
+          scopeStack_.push_back(scopeInfo_.at(&exp));
+          // the function's name refers to it in its body (resolveSelf)
+          selfFunctions_[scopeStack_.back().get()] = AS_FUNCTION(fn);
 
           for (auto i = 0; i < arity; i++) {
             auto argName = params[i].string;
-            co->addLocal(argName);
+            declareLocal(argName, i);
+          }
+          // the frame starts at the args, pushed by the caller
+          co->stackDepth = arity;
+
+          // a non-block body is compiled one level deeper, so blocks
+          // nested in it aren't taken for the function body
+          auto isBlockBody = isBlock(exp.list[3]);
+          if (!isBlockBody) {
+            co->scopeLevel++;
           }
-
           gen(exp.list[3]);
-          if (!isBlock(exp.list[3])) {
-            emit(OP_SCOPE_EXIT);
-            emit(arity + 1); // +1 for function itself to be set as a local
+          scopeStack_.pop_back();
+          if (!isBlockBody) {
+            co->scopeLevel--;
+            if (arity > 0) {
+              emit(OP_SCOPE_EXIT);
+              emit(arity);
+            }
           }
           emit(OP_RETURN); // explicit return to restore caller address
 
-          auto fn = ALLOC_FUNCTION(co);
           co=prevCo;
           co->addConst(fn);
 
           // emit code for new constant
           emit(OP_CONST);
-          emit(co->constants.size()-1); 
+          emitConstIndex(co->constants.size()-1);
 
 
           if (isGlobalScope()) {
             global->define(fnName);
             emit(OP_SET_GLOBAL);
-            emit(global->getGlobalIndex(fnName));
+            emitGlobalIndex(global->getGlobalIndex(fnName), fnName);
           } else {
-            co->addLocal(fnName);
             emit(OP_SET_LOCAL);
-            emit(co->getLocalIndex(fnName));
+            emit(declareLocal(fnName, co->stackDepth - 1));
           }
         }
 
         // function calls
-        else {
+        else if (!genDirectCall(exp)) {
           // push function onto stack
           FUNCTION_CALL(exp);
           }
@@ -432,6 +602,16 @@ class VioCompiler {
    */
   FunctionObject* getMainFunction() { return main; }
 
+  /**
+   * Registers a program loaded from the bytecode cache in place
+   * of a compiled one.
+   */
+  void adopt(FunctionObject* entry, const std::vector<CodeObject*>& loaded) {
+    main = entry;
+    co = entry->co;
+    codeObjects_.insert(codeObjects_.end(), loaded.begin(), loaded.end());
+  }
+
   /**
    * Returns all constant traceable objects.
    */
@@ -448,6 +628,31 @@ class VioCompiler {
    */
   std::unique_ptr<VioDisassembler> disassembler;
 
+  /**
+   * AST constant folding pass.
+   */
+  VioConstantFolder constantFolder_;
+
+  /**
+   * AST inliner of small global functions.
+   */
+  VioInliner inliner_;
+
+  /**
+   * IR optimization pipeline.
+   */
+  VioPassManager passManager_;
+
+  /**
+   * Optimization level.
+   */
+  OptLevel optLevel_;
+
+  /**
+   * Whether programs are snippets of a session.
+   */
+  bool incremental_ = false;
+
   /**
    * Enter a new scope
    */
@@ -463,7 +668,7 @@ class VioCompiler {
       emit(OP_SCOPE_EXIT);
 
       if (isFunctionBody()) {
-        varsCount+= co->arity+1;
+        varsCount+= co->arity;
       }
       emit(varsCount);
     }
@@ -482,9 +687,6 @@ class VioCompiler {
     co = AS_CODE(coValue);
 
     prevCo->constants.push_back(coValue); // store as a new constant
-    co->addLocal(fnName); //register function name as local variable to enable calling recursively
-
-
     for (auto i = 0; i < arity; i++) {
       auto argName = exp.list[2].list[1].string;
       co->addLocal(argName);
@@ -492,9 +694,9 @@ class VioCompiler {
 
     // compile the function body
     gen(body); 
-    if (!isBlock(body)) {
+    if (!isBlock(body) && arity > 0) {
       emit(OP_SCOPE_EXIT);
-      emit(arity + 1); // +1 for function itself to be set as a local
+      emit(arity);
     }
     emit(OP_RETURN); // explicit return to restore caller address
 
@@ -504,7 +706,76 @@ class VioCompiler {
 
     // emit code for new constant
     emit(OP_CONST);
-    emit(co->constants.size()-1); 
+    emitConstIndex(co->constants.size()-1);
+  }
+
+  /**
+   * Records names which are reassigned, or declared more than once:
+   * only other global functions are called directly.
+   */
+  void collectAssignments(const Exp& exp) {
+    if (exp.type != ExpType::LIST || exp.list.empty()) {
+      return;
+    }
+    if (isTaggedList(exp, "set") && exp.list.size() > 1) {
+      assignedNames_.insert(exp.list[1].string);
+    } else if ((isTaggedList(exp, "var") || isTaggedList(exp, "def")) &&
+               exp.list.size() > 1) {
+      declCounts_[exp.list[1].string]++;
+    }
+    for (auto& e : exp.list) {
+      collectAssignments(e);
+    }
+  }
+
+  /**
+   * Emits a call to a known global function as OP_CALL_DIRECT:
+   * args only, then the callee constant and the args count.
+   * Returns false if the callee is only known at runtime.
+   */
+  bool genDirectCall(const Exp& exp) {
+    auto& tag = exp.list[0];
+    if (tag.type != ExpType::SYMBOL) {
+      return false;
+    }
+    auto it = directCallees_.find(tag.string);
+    if (it == directCallees_.end()) {
+      return false;
+    }
+    auto callee = it->second;
+    // a local, or the name of another function being compiled, shadows
+    // the global
+    auto self = resolveSelf(tag.string);
+    if (resolveLocal(tag.string) != -1 || (self != nullptr && self != callee)) {
+      return false;
+    }
+
+    auto argsCount = exp.list.size() - 1;
+    if (argsCount != callee->co->arity) {
+      DIE << "[VioCompiler]: Arity error: " << tag.string << " expects "
+          << callee->co->arity << " arguments, got " << argsCount;
+    }
+    for (size_t i = 1; i < exp.list.size(); i++) {
+      gen(exp.list[i]);
+    }
+    emit(OP_CALL_DIRECT);
+    emitConstIndex(functionConstIdx(callee));
+    emit(argsCount);
+    return true;
+  }
+
+  /**
+   * Allocates a function constant.
+   */
+  size_t functionConstIdx(FunctionObject* fn) {
+    for (size_t i = 0; i < co->constants.size(); i++) {
+      if (IS_FUNCTION(co->constants[i]) &&
+          AS_FUNCTION(co->constants[i]) == fn) {
+        return i;
+      }
+    }
+    co->addConst((VioValue){VioValueType::OBJECT, .object = (Object*)fn});
+    return co->constants.size() - 1;
   }
 
   /**
@@ -597,7 +868,8 @@ class VioCompiler {
     auto varsCount = 0;
 
     if(co->locals.size() > 0) {
-      while (co->locals.back().scopeLevel == co->scopeLevel) {
+      while (!co->locals.empty() &&
+             co->locals.back().scopeLevel == co->scopeLevel) {
         co->locals.pop_back();
         varsCount++;
       }
@@ -605,6 +877,50 @@ class VioCompiler {
     return varsCount;
   }
 
+  /**
+   * Registers a local living in the given stack slot (relative
+   * to the frame base) in the current code object and scope.
+   */
+  int declareLocal(const std::string& name, int slot) {
+    co->addLocal(name, slot);
+    scopeStack_.back()->setSlot(name, slot);
+    return slot;
+  }
+
+  /**
+   * The function being compiled if `name` is its own name (which is
+   * compiled to the function constant, frames have no callee slot),
+   * nullptr otherwise.
+   */
+  FunctionObject* resolveSelf(const std::string& name) {
+    for (auto it = scopeStack_.rbegin(); it != scopeStack_.rend(); ++it) {
+      if ((*it)->type == ScopeType::FUNCTION) {
+        auto self = selfFunctions_.find(it->get());
+        return self != selfFunctions_.end() && self->second->co->name == name
+                   ? self->second
+                   : nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Resolves a local variable to its stack slot through the scope
+   * chain of the current function, returns -1 if it's not a local.
+   */
+  int resolveLocal(const std::string& name) {
+    for (auto it = scopeStack_.rbegin(); it != scopeStack_.rend(); ++it) {
+      auto slot = (*it)->getSlot(name);
+      if (slot != -1) {
+        return slot;
+      }
+      if ((*it)->type == ScopeType::FUNCTION) {
+        break;
+      }
+    }
+    return -1;
+  }
+
   /**
    * Returns current bytecode offset.
    */
@@ -614,31 +930,84 @@ class VioCompiler {
    * Allocates a numeric constant.
    */
   size_t numericConstIdx(double value) {
-    ALLOC_CONST(IS_NUMBER, AS_NUMBER, NUMBER, value);
-    return co->constants.size() - 1;
+    ALLOC_CONST(numberConstIndex, NUMBER, value);
+  }
+
+  /**
+   * Allocates an integer constant.
+   */
+  size_t integerConstIdx(int64_t value) {
+    ALLOC_CONST(integerConstIndex, INTEGER, value);
   }
 
   /**
    * Allocates a string constant.
    */
   size_t stringConstIdx(const std::string& value) {
-    ALLOC_CONST(IS_STRING, AS_CPPSTRING, ALLOC_STRING, value);
+    ALLOC_CONST(stringConstIndex, ALLOC_STRING, value);
     // constantObjects_.insert((Traceable*)co->constants.back().object);
-    return co->constants.size() - 1;
   }
 
   /**
    * Allocates a boolean constant.
    */
   size_t booleanConstIdx(bool value) {
-    ALLOC_CONST(IS_BOOLEAN, AS_BOOLEAN, BOOLEAN, value);
-    return co->constants.size() - 1;
+    ALLOC_CONST(booleanConstIndex, BOOLEAN, value);
+  }
+
+  /**
+   * Emits the index of a constant, a single byte like global indices.
+   */
+  void emitConstIndex(size_t index) {
+    if (index > UINT8_MAX) {
+      DIE << "[VioCompiler]: Too many constants in " << co->name
+          << ": the limit is " << UINT8_MAX + 1 << " per function";
+    }
+    emit(index);
+  }
+
+  /**
+   * Emits the index of a global: operands are single bytes, so there
+   * are at most 256 globals, the natives of the VM included.
+   */
+  void emitGlobalIndex(int index, const std::string& name) {
+    if (index > UINT8_MAX) {
+      DIE << "[VioCompiler]: Too many globals: " << name << " would be global "
+          << index << ", the limit is " << UINT8_MAX + 1
+          << " (including the natives)";
+    }
+    emit(index);
   }
 
   /**
    * Emits data to the bytecode.
    */
-  void emit(uint8_t code) { co->code.push_back(code); }
+  void emit(uint8_t code) {
+    co->code.push_back(code);
+    trackStackDepth(code);
+  }
+
+  /**
+   * Tracks the operand stack depth of the current code object,
+   * so locals get the slot where their value actually lives.
+   */
+  void trackStackDepth(uint8_t code) {
+    if (pendingOperands_ == 0) {
+      pendingInstruction_ = IRInstruction{code};
+      pendingOperands_ = opcodeSize(code) - 1;
+    } else if (pendingOperands_ == opcodeSize(pendingInstruction_.opcode) - 1) {
+      pendingInstruction_.operand = code;
+      pendingOperands_--;
+    } else {
+      // second operand: argument count of a direct call
+      pendingInstruction_.count = code;
+      pendingOperands_--;
+    }
+    if (pendingOperands_ == 0) {
+      co->stackDepth += (int)pendingInstruction_.pushes() -
+                        (int)pendingInstruction_.pops();
+    }
+  }
 
   /**
    * Writes byte at offset.
@@ -662,21 +1031,43 @@ class VioCompiler {
   //   // Implement here...
   // }
 
-  // /**
-  //  * Scope info.
-  //  */
-  // std::map<const Exp*, std::shared_ptr<Scope>> scopeInfo_;
+  /**
+   * Names reassigned with `set`, and declarations per name.
+   */
+  std::set<std::string> assignedNames_;
+  std::map<std::string, size_t> declCounts_;
+
+  /**
+   * Global functions called with OP_CALL_DIRECT, by name.
+   */
+  std::map<std::string, FunctionObject*> directCallees_;
+
+  /**
+   * Scope info.
+   */
+  std::unordered_map<const Exp*, std::shared_ptr<Scope>> scopeInfo_;
+
+  /**
+   * Functions of the function scopes, for references to their own name.
+   */
+  std::unordered_map<const Scope*, FunctionObject*> selfFunctions_;
 
-  // /**
-  //  * Scopes stack.
-  //  */
-  // std::stack<std::shared_ptr<Scope>> scopeStack_;
+  /**
+   * Scopes stack.
+   */
+  std::vector<std::shared_ptr<Scope>> scopeStack_;
 
   /**
    * Compiling code object.
    */
   CodeObject* co;
 
+  /**
+   * Currently emitted instruction, and its operand bytes left.
+   */
+  IRInstruction pendingInstruction_;
+  size_t pendingOperands_ = 0;
+
   /**
    * Main entry point (function).
    */
@@ -703,15 +1094,15 @@ class VioCompiler {
   // std::vector<ClassObject*> classObjects_;
 
   /**
-   * Compare ops map.
+   * Compare ops map (immutable, shared by all compilers).
    */
-  static std::map<std::string, uint8_t> compareOps_;
+  static const std::map<std::string, uint8_t> compareOps_;
 };
 
 /**
  * Compare ops map.
  */
-std::map<std::string, uint8_t> VioCompiler::compareOps_ = {
+const std::map<std::string, uint8_t> VioCompiler::compareOps_ = {
     {"<", 0}, {">", 1}, {"==", 2}, {">=", 3}, {"<=", 4}, {"!=", 5},
 };
 
@@ -0,0 +1,336 @@
+/**
+ * Constant folding and propagation.
+ */
+
+#ifndef VioConstantFolder_h
+#define VioConstantFolder_h
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../parser/VioParser.h"
+
+/**
+ * AST-level optimization pass.
+ *
+ * Folds arithmetic, comparisons and string concatenation on literals,
+ * resolves `if` with a literal test, and propagates `var` bindings
+ * which are never reassigned with `set`.
+ */
+class VioConstantFolder {
+ public:
+  /**
+   * Whether top-level (global) vars are propagated. Disabled when
+   * later programs of a session may reassign them.
+   */
+  void setPropagateGlobals(bool enabled) { propagateGlobals_ = enabled; }
+
+  /**
+   * Main fold API: returns an optimized copy of the expression.
+   */
+  Exp fold(const Exp& exp) {
+    setNames_.clear();
+    declCount_.clear();
+    scopes_.clear();
+
+    collectAssignments(exp);
+
+    scopes_.emplace_back();
+    auto result = foldExp(exp);
+    scopes_.pop_back();
+
+    return result;
+  }
+
+ private:
+  /**
+   * Binding of a name in a scope: a literal (if constant) or nothing.
+   */
+  struct Binding {
+    bool isConstant;
+    Exp value;
+  };
+
+  using Scope = std::map<std::string, Binding>;
+
+  /**
+   * Records names which are reassigned, or declared more than once.
+   * Such bindings are never propagated.
+   */
+  void collectAssignments(const Exp& exp) {
+    if (exp.type != ExpType::LIST || exp.list.empty()) {
+      return;
+    }
+    if (isTaggedList(exp, "set") && exp.list.size() > 1) {
+      setNames_.insert(exp.list[1].string);
+    } else if ((isTaggedList(exp, "var") || isTaggedList(exp, "def")) &&
+               exp.list.size() > 1) {
+      declCount_[exp.list[1].string]++;
+    }
+    for (auto& e : exp.list) {
+      collectAssignments(e);
+    }
+  }
+
+  /**
+   * Folds an expression recursively.
+   */
+  Exp foldExp(const Exp& exp) {
+    switch (exp.type) {
+      case ExpType::NUMBER:
+      case ExpType::STRING:
+        return exp;
+
+      case ExpType::SYMBOL: {
+        auto binding = lookup(exp.string);
+        if (binding != nullptr && binding->isConstant) {
+          return binding->value;
+        }
+        return exp;
+      }
+
+      case ExpType::LIST:
+        break;
+    }
+
+    if (exp.list.empty() || exp.list[0].type != ExpType::SYMBOL) {
+      return foldList(exp, 0);
+    }
+
+    auto op = exp.list[0].string;
+
+    if (isArithmetic(op) && exp.list.size() == 3) {
+      auto folded = foldList(exp, 1);
+      Exp result(0);
+      if (foldArithmetic(op, folded.list[1], folded.list[2], result)) {
+        return result;
+      }
+      return folded;
+    }
+
+    if (isComparison(op) && exp.list.size() == 3) {
+      auto folded = foldList(exp, 1);
+      bool result;
+      if (foldComparison(op, folded.list[1], folded.list[2], result)) {
+        return booleanExp(result);
+      }
+      return folded;
+    }
+
+    if (op == "if") {
+      auto folded = foldList(exp, 1);
+      auto& test = folded.list[1];
+      if (isBooleanLiteral(test, true)) {
+        return folded.list[2];
+      }
+      if (isBooleanLiteral(test, false)) {
+        return folded.list.size() == 4 ? folded.list[3] : booleanExp(false);
+      }
+      return folded;
+    }
+
+    if (op == "var") {
+      auto folded = foldList(exp, 2);
+      auto& name = folded.list[1].string;
+      auto& init = folded.list[2];
+      // scopes_[1] is the top-level block of the program.
+      bool isConstant = isLiteral(init) && setNames_.count(name) == 0 &&
+                        declCount_[name] == 1 &&
+                        (propagateGlobals_ || scopes_.size() > 2);
+      bind(name, Binding{isConstant, init});
+      return folded;
+    }
+
+    if (op == "set") {
+      return foldList(exp, 2);
+    }
+
+    if (op == "begin") {
+      scopes_.emplace_back();
+      auto folded = foldList(exp, 1);
+      scopes_.pop_back();
+      return folded;
+    }
+
+    if (op == "def") {
+      // Function name and params shadow outer bindings.
+      bind(exp.list[1].string, Binding{false, exp.list[1]});
+      scopes_.emplace_back();
+      for (auto& param : exp.list[2].list) {
+        bind(param.string, Binding{false, param});
+      }
+      auto folded = foldList(exp, 3);
+      scopes_.pop_back();
+      return folded;
+    }
+
+    // Function calls and other forms:
+    return foldList(exp, 0);
+  }
+
+  /**
+   * Folds elements of the list starting from `from`.
+   */
+  Exp foldList(const Exp& exp, size_t from) {
+    std::vector<Exp> list;
+    list.reserve(exp.list.size());
+    for (size_t i = 0; i < exp.list.size(); i++) {
+      list.push_back(i < from ? exp.list[i] : foldExp(exp.list[i]));
+    }
+    return Exp(list);
+  }
+
+  /**
+   * Folds (op a b) on number or string literals.
+   */
+  bool foldArithmetic(const std::string& op, const Exp& a, const Exp& b,
+                      Exp& result) {
+    if (a.type == ExpType::STRING && b.type == ExpType::STRING) {
+      if (op != "+") {
+        return false;
+      }
+      result = stringExp(a.string + b.string);
+      return true;
+    }
+
+    if (a.type != ExpType::NUMBER || b.type != ExpType::NUMBER) {
+      return false;
+    }
+
+    int64_t x = a.number;
+    int64_t y = b.number;
+    int64_t r;
+
+    // Results promoted to doubles at runtime aren't literals.
+    if (op == "+") {
+      if (__builtin_add_overflow(x, y, &r)) {
+        return false;
+      }
+    } else if (op == "-") {
+      if (__builtin_sub_overflow(x, y, &r)) {
+        return false;
+      }
+    } else if (op == "*") {
+      if (__builtin_mul_overflow(x, y, &r)) {
+        return false;
+      }
+    } else {
+      // Only exact integer division is representable as a literal.
+      if (y == 0 || (x == INT64_MIN && y == -1) || x % y != 0) {
+        return false;
+      }
+      r = x / y;
+    }
+
+    result = Exp(r);
+    return true;
+  }
+
+  /**
+   * Folds comparison on number or string literals.
+   */
+  bool foldComparison(const std::string& op, const Exp& a, const Exp& b,
+                      bool& result) {
+    if (a.type == ExpType::NUMBER && b.type == ExpType::NUMBER) {
+      result = compare(op, a.number, b.number);
+      return true;
+    }
+    if (a.type == ExpType::STRING && b.type == ExpType::STRING) {
+      result = compare(op, a.string, b.string);
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Generic comparison, mirrors COMPARE_VALUES in the VM.
+   */
+  template <typename T>
+  bool compare(const std::string& op, const T& v1, const T& v2) {
+    if (op == "<") return v1 < v2;
+    if (op == ">") return v1 > v2;
+    if (op == "==") return v1 == v2;
+    if (op == ">=") return v1 >= v2;
+    if (op == "<=") return v1 <= v2;
+    return v1 != v2;
+  }
+
+  /**
+   * Binds a name in the current scope.
+   */
+  void bind(const std::string& name, const Binding& binding) {
+    scopes_.back().insert_or_assign(name, binding);
+  }
+
+  /**
+   * Finds the innermost binding of a name.
+   */
+  Binding* lookup(const std::string& name) {
+    for (auto it = scopes_.rbegin(); it != scopes_.rend(); ++it) {
+      auto binding = it->find(name);
+      if (binding != it->end()) {
+        return &binding->second;
+      }
+    }
+    return nullptr;
+  }
+
+  bool isArithmetic(const std::string& op) {
+    return op == "+" || op == "-" || op == "*" || op == "/";
+  }
+
+  bool isComparison(const std::string& op) {
+    return op == "<" || op == ">" || op == "==" || op == ">=" || op == "<=" ||
+           op == "!=";
+  }
+
+  /**
+   * Numbers, strings and booleans.
+   */
+  bool isLiteral(const Exp& exp) {
+    return exp.type == ExpType::NUMBER || exp.type == ExpType::STRING ||
+           isBooleanLiteral(exp, true) || isBooleanLiteral(exp, false);
+  }
+
+  bool isBooleanLiteral(const Exp& exp, bool value) {
+    return exp.type == ExpType::SYMBOL &&
+           exp.string == (value ? "true" : "false");
+  }
+
+  bool isTaggedList(const Exp& exp, const std::string& tag) {
+    return exp.type == ExpType::LIST && !exp.list.empty() &&
+           exp.list[0].type == ExpType::SYMBOL && exp.list[0].string == tag;
+  }
+
+  Exp booleanExp(bool value) {
+    std::string name = value ? "true" : "false";
+    return Exp(name);
+  }
+
+  Exp stringExp(const std::string& value) {
+    std::string quoted = '"' + value + '"';
+    return Exp(quoted);
+  }
+
+  /**
+   * Names reassigned with `set` anywhere in the program.
+   */
+  std::set<std::string> setNames_;
+
+  /**
+   * Number of declarations (`var`/`def`) per name.
+   */
+  std::map<std::string, size_t> declCount_;
+
+  /**
+   * Lexical scopes of the currently folded expression.
+   */
+  std::vector<Scope> scopes_;
+
+  bool propagateGlobals_ = true;
+};
+
+#endif
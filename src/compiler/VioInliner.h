@@ -0,0 +1,364 @@
+/**
+ * Function inliner.
+ */
+
+#ifndef VioInliner_h
+#define VioInliner_h
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../parser/VioParser.h"
+
+/**
+ * AST-level inliner of small global functions.
+ *
+ * A call `(square 3)` to `(def square (x) (* x x))` is replaced by
+ * `(begin (var x@square.1 3) (* x@square.1 x@square.1))`: the params
+ * become locals of the caller's frame, evaluated once, in order.
+ *
+ * Only non-recursive global functions which are declared once and never
+ * reassigned with `set` are inlined, so a reassigned global always goes
+ * through a regular call.
+ */
+class VioInliner {
+ public:
+  VioInliner(size_t maxBodySize = 32, size_t maxDepth = 3)
+      : maxBodySize_(maxBodySize), maxDepth_(maxDepth) {}
+
+  /**
+   * Main API: returns a copy of the program with calls inlined.
+   */
+  Exp inlineCalls(const Exp& exp) {
+    setNames_.clear();
+    declCount_.clear();
+    candidates_.clear();
+    scopes_.clear();
+    counter_ = 0;
+
+    collectAssignments(exp);
+    return walk(exp);
+  }
+
+ private:
+  /**
+   * Inlinable function.
+   */
+  struct Candidate {
+    std::vector<std::string> params;
+    Exp body;
+
+    /**
+     * Names the body refers to which must resolve to globals.
+     */
+    std::set<std::string> freeNames;
+
+    /**
+     * Nesting depth of inlined bodies within this body (1 if none).
+     */
+    size_t depth;
+  };
+
+  /**
+   * Records names which are reassigned, or declared more than once.
+   */
+  void collectAssignments(const Exp& exp) {
+    if (exp.type != ExpType::LIST || exp.list.empty()) {
+      return;
+    }
+    if (isTaggedList(exp, "set") && exp.list.size() > 1) {
+      setNames_.insert(exp.list[1].string);
+    } else if ((isTaggedList(exp, "var") || isTaggedList(exp, "def")) &&
+               exp.list.size() > 1) {
+      declCount_[exp.list[1].string]++;
+    }
+    for (auto& e : exp.list) {
+      collectAssignments(e);
+    }
+  }
+
+  /**
+   * Walks the program, inlining calls to known candidates.
+   * `depth` is set to the max inlining depth within `exp`.
+   */
+  Exp walk(const Exp& exp) {
+    size_t depth = 0;
+    return walk(exp, depth);
+  }
+
+  Exp walk(const Exp& exp, size_t& depth) {
+    if (exp.type != ExpType::LIST || exp.list.empty()) {
+      return exp;
+    }
+
+    auto& tag = exp.list[0];
+    auto op = tag.type == ExpType::SYMBOL ? tag.string : "";
+
+    if (op == "begin") {
+      scopes_.emplace_back();
+      auto result = walkList(exp, 1, depth);
+      scopes_.pop_back();
+      return result;
+    }
+
+    if (op == "var") {
+      auto result = walkList(exp, 2, depth);
+      declare(exp.list[1].string);
+      return result;
+    }
+
+    if (op == "set") {
+      return walkList(exp, 2, depth);
+    }
+
+    if (op == "def") {
+      auto fnName = exp.list[1].string;
+      auto isGlobal = scopes_.size() == 1;
+      declare(fnName);
+
+      scopes_.emplace_back();
+      declare(fnName);
+      for (auto& param : exp.list[2].list) {
+        declare(param.string);
+      }
+      size_t bodyDepth = 0;
+      auto result = walkList(exp, 3, bodyDepth);
+      scopes_.pop_back();
+
+      if (isGlobal) {
+        maybeAddCandidate(result, bodyDepth + 1);
+      }
+      return result;
+    }
+
+    // Special forms and operators: only the operands are walked.
+    if (op == "if" || op == "while" || isOperator(op)) {
+      return walkList(exp, 1, depth);
+    }
+
+    // Function call.
+    auto result = walkList(exp, 0, depth);
+    if (op.empty() || candidates_.count(op) == 0) {
+      return result;
+    }
+    auto& candidate = candidates_.at(op);
+    if (!canInlineAt(op, candidate, result)) {
+      return result;
+    }
+    depth = std::max(depth, candidate.depth);
+    return inlineCall(op, candidate, result);
+  }
+
+  /**
+   * Walks elements of the list starting from `from`.
+   */
+  Exp walkList(const Exp& exp, size_t from, size_t& depth) {
+    std::vector<Exp> list;
+    list.reserve(exp.list.size());
+    for (size_t i = 0; i < exp.list.size(); i++) {
+      list.push_back(i < from ? exp.list[i] : walk(exp.list[i], depth));
+    }
+    return Exp(list);
+  }
+
+  /**
+   * Registers a global def as an inline candidate if it fits the budget.
+   */
+  void maybeAddCandidate(const Exp& def, size_t depth) {
+    auto& fnName = def.list[1].string;
+    auto& body = def.list[3];
+
+    if (declCount_[fnName] != 1 || setNames_.count(fnName) != 0 ||
+        depth > maxDepth_ || size(body) > maxBodySize_) {
+      return;
+    }
+
+    Candidate candidate{{}, body, {}, depth};
+    for (auto& param : def.list[2].list) {
+      candidate.params.push_back(param.string);
+    }
+
+    std::set<std::string> params(candidate.params.begin(),
+                                 candidate.params.end());
+    if (!collectFreeNames(body, params, candidate.freeNames) ||
+        candidate.freeNames.count(fnName) != 0) {
+      return;
+    }
+    candidates_.insert_or_assign(fnName, candidate);
+  }
+
+  /**
+   * Collects symbols of the body other than params. Returns false if
+   * the body can't be inlined: nested functions, or params redeclared.
+   */
+  bool collectFreeNames(const Exp& exp, const std::set<std::string>& params,
+                        std::set<std::string>& names) {
+    if (exp.type == ExpType::SYMBOL) {
+      if (params.count(exp.string) == 0 && exp.string != "true" &&
+          exp.string != "false") {
+        names.insert(exp.string);
+      }
+      return true;
+    }
+    if (exp.type != ExpType::LIST) {
+      return true;
+    }
+    if (isTaggedList(exp, "def")) {
+      return false;
+    }
+    if (isTaggedList(exp, "var") && params.count(exp.list[1].string) != 0) {
+      return false;
+    }
+    for (auto& e : exp.list) {
+      if (!collectFreeNames(e, params, names)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Whether the call resolves to the global candidate, and the names
+   * its body uses aren't shadowed by locals at the call site.
+   */
+  bool canInlineAt(const std::string& fnName, const Candidate& candidate,
+                   const Exp& call) {
+    if (call.list.size() - 1 != candidate.params.size() ||
+        isLocal(fnName)) {
+      return false;
+    }
+    for (auto& name : candidate.freeNames) {
+      if (isLocal(name)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * (f a b) -> (begin (var x@f.N a) (var y@f.N b) <body>)
+   */
+  Exp inlineCall(const std::string& fnName, const Candidate& candidate,
+                 const Exp& call) {
+    auto suffix = "@" + fnName + "." + std::to_string(++counter_);
+
+    std::map<std::string, std::string> renames;
+    std::vector<Exp> block{symbol("begin")};
+
+    for (size_t i = 0; i < candidate.params.size(); i++) {
+      auto& param = candidate.params[i];
+      renames[param] = param + suffix;
+      block.push_back(
+          Exp(std::vector<Exp>{symbol("var"), symbol(renames[param]),
+                               call.list[i + 1]}));
+    }
+    block.push_back(rename(candidate.body, renames));
+    return Exp(block);
+  }
+
+  /**
+   * Renames symbols in the expression.
+   */
+  Exp rename(const Exp& exp, const std::map<std::string, std::string>& names) {
+    if (exp.type == ExpType::SYMBOL) {
+      auto it = names.find(exp.string);
+      return it == names.end() ? exp : symbol(it->second);
+    }
+    if (exp.type != ExpType::LIST) {
+      return exp;
+    }
+    std::vector<Exp> list;
+    list.reserve(exp.list.size());
+    for (auto& e : exp.list) {
+      list.push_back(rename(e, names));
+    }
+    return Exp(list);
+  }
+
+  /**
+   * Number of nodes in the expression.
+   */
+  size_t size(const Exp& exp) {
+    size_t count = 1;
+    for (auto& e : exp.list) {
+      count += size(e);
+    }
+    return count;
+  }
+
+  /**
+   * Declares a name in the current scope.
+   */
+  void declare(const std::string& name) {
+    if (!scopes_.empty()) {
+      scopes_.back().insert(name);
+    }
+  }
+
+  /**
+   * Whether the name is bound by a non-global scope.
+   */
+  bool isLocal(const std::string& name) {
+    for (size_t i = 1; i < scopes_.size(); i++) {
+      if (scopes_[i].count(name) != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool isOperator(const std::string& op) {
+    return op == "+" || op == "-" || op == "*" || op == "/" || op == "<" ||
+           op == ">" || op == "==" || op == ">=" || op == "<=" || op == "!=";
+  }
+
+  bool isTaggedList(const Exp& exp, const std::string& tag) {
+    return exp.type == ExpType::LIST && !exp.list.empty() &&
+           exp.list[0].type == ExpType::SYMBOL && exp.list[0].string == tag;
+  }
+
+  Exp symbol(const std::string& name) {
+    std::string value = name;
+    return Exp(value);
+  }
+
+  /**
+   * Max size (in AST nodes) of an inlined body.
+   */
+  size_t maxBodySize_;
+
+  /**
+   * Max depth of nested inlining.
+   */
+  size_t maxDepth_;
+
+  /**
+   * Names reassigned with `set` anywhere in the program.
+   */
+  std::set<std::string> setNames_;
+
+  /**
+   * Number of declarations (`var`/`def`) per name.
+   */
+  std::map<std::string, size_t> declCount_;
+
+  /**
+   * Inlinable global functions by name.
+   */
+  std::map<std::string, Candidate> candidates_;
+
+  /**
+   * Names declared in each scope, the first one is global.
+   */
+  std::vector<std::set<std::string>> scopes_;
+
+  /**
+   * Counter for unique names of inlined params.
+   */
+  size_t counter_;
+};
+
+#endif
@@ -8,6 +8,7 @@
 #include <array>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include "../bytecode/OpCode.h"
@@ -24,10 +25,11 @@ class VioDisassembler {
    * Disassembles a code unit.
    */
   void disassemble(CodeObject* co) {
+    co->resolve();
     std::cout << "\n---------------Disassembly:" << co->name 
               << "----------\n\n";
     size_t offset = 0;
-    while (offset < co->code.size()) {
+    while (offset < co->codeSize()) {
       offset = disassembleInstruction(co, offset);
       std::cout << "\n";
     }
@@ -41,7 +43,7 @@ class VioDisassembler {
     std::ios_base::fmtflags f(std::cout.flags());
     std::cout << std::uppercase << std::hex << std::setfill('0') << std::setw(4)
               << offset << "   ";
-    auto opcode = co->code[offset];
+    auto opcode = co->codeBegin()[offset];
 
     switch (opcode) {
       case OP_HALT:
@@ -51,13 +53,27 @@ class VioDisassembler {
       case OP_DIV:
       case OP_POP:
       case OP_RETURN:
+      case OP_ADD_NUM:
+      case OP_SUB_NUM:
+      case OP_MUL_NUM:
+      case OP_DIV_NUM:
+      case OP_YIELD:
+      case OP_RESUME:
         return disassembleSimple(co, opcode, offset);
       case OP_SCOPE_EXIT:
       case OP_CALL:
         return disassembleWord(co, opcode, offset);
       case OP_CONST:
         return disassembleConst(co, opcode, offset);
+      case OP_CALL_DIRECT:
+        return disassembleCallDirect(co, opcode, offset);
       case OP_COMPARE:
+      case OP_LT_NUM:
+      case OP_GT_NUM:
+      case OP_EQ_NUM:
+      case OP_GE_NUM:
+      case OP_LE_NUM:
+      case OP_NE_NUM:
         return disassembleCompare(co, opcode, offset);
       case OP_JMP_IF_FALSE:
         return disassembleJump(co, opcode, offset);
@@ -92,7 +108,7 @@ class VioDisassembler {
   size_t disassembleWord(CodeObject* co, uint8_t opcode, size_t offset) {
     dumpBytes(co, offset, 2);
     printOpCode(opcode);
-    std::cout << (int)co->code[offset + 1];
+    std::cout << (int)co->codeBegin()[offset + 1];
     return offset + 2;
   }
 
@@ -102,19 +118,33 @@ class VioDisassembler {
   size_t disassembleConst(CodeObject* co, uint8_t opcode, size_t offset) {
     dumpBytes(co, offset, 2);
     printOpCode(opcode);
-    auto constIndex = co->code[offset + 1];
+    auto constIndex = co->codeBegin()[offset + 1];
     std::cout << (int)constIndex << " ("
               << vioValueToConstantString(co->constants[constIndex]) << ")";
     return offset + 2;
   }
 
+  /**
+   * Disassembles direct call: OP_CALL_DIRECT <callee> <args count>
+   */
+  size_t disassembleCallDirect(CodeObject* co, uint8_t opcode,
+                               size_t offset) {
+    dumpBytes(co, offset, 3);
+    printOpCode(opcode);
+    auto constIndex = co->codeBegin()[offset + 1];
+    std::cout << (int)constIndex << " ("
+              << vioValueToConstantString(co->constants[constIndex]) << ") "
+              << (int)co->codeBegin()[offset + 2];
+    return offset + 3;
+  }
+
   /**
    * Disassembles global variable instruction.
    */
   size_t disassembleGlobal(CodeObject* co, uint8_t opcode, size_t offset) {
     dumpBytes(co, offset, 2);
     printOpCode(opcode);
-    auto globalIndex = co->code[offset + 1];
+    auto globalIndex = co->codeBegin()[offset + 1];
     std::cout << (int)globalIndex << " ("
               << global->get(globalIndex).name << ")";
     return offset + 2;
@@ -126,9 +156,15 @@ class VioDisassembler {
   size_t disassembleLocal(CodeObject* co, uint8_t opcode, size_t offset) {
     dumpBytes(co, offset, 2);
     printOpCode(opcode);
-    auto localIndex = co->code[offset + 1];
-    std::cout << (int)localIndex << " ("
-              << co->locals[localIndex].name << ")";
+    auto localIndex = co->codeBegin()[offset + 1];
+    std::cout << (int)localIndex;
+    // Block locals are dropped on scope exit, only function-level remain.
+    for (auto& local : co->locals) {
+      if (local.slot == localIndex) {
+        std::cout << " (" << local.name << ")";
+        break;
+      }
+    }
     return offset + 2;
   }
 
@@ -162,7 +198,7 @@ class VioDisassembler {
     std::stringstream ss;
     for (auto i = 0; i < count; i++) {
       ss << std::uppercase << std::hex << std::setfill('0') << std::setw(2)
-         << (((int)co->code[offset + i]) & 0xFF) << " ";
+         << (((int)co->codeBegin()[offset + i]) & 0xFF) << " ";
     }
     std::cout << std::left << std::setfill(' ') << std::setw(12) << ss.str();
     std::cout.flags(f);
@@ -184,7 +220,7 @@ class VioDisassembler {
   size_t disassembleCompare(CodeObject* co, uint8_t opcode, size_t offset) {
     dumpBytes(co, offset, 2);
     printOpCode(opcode);
-    auto compareOp = co->code[offset+1];
+    auto compareOp = co->codeBegin()[offset+1];
     std::cout << (int)compareOp << " (";
     std::cout << inverseCompareOps_[compareOp] << ")";
     return offset + 2;
@@ -212,7 +248,7 @@ class VioDisassembler {
    * Reads a word at offset.
    */
   uint16_t readWordAtOffset(CodeObject* co, size_t offset) {
-    return (uint16_t)((co->code[offset] << 8) | co->code[offset + 1]);
+    return (uint16_t)((co->codeBegin()[offset] << 8) | co->codeBegin()[offset + 1]);
   }
 
   /**
@@ -220,10 +256,10 @@ class VioDisassembler {
    */
   std::shared_ptr<Global> global;
 
-  static std::array<std::string, 6> inverseCompareOps_;
+  static const std::array<std::string, 6> inverseCompareOps_;
 };
 
-std::array<std::string, 6> VioDisassembler::inverseCompareOps_ = {
+const std::array<std::string, 6> VioDisassembler::inverseCompareOps_ = {
     "<", ">", "==", ">=", "<=", "!=",
 };
 
@@ -12,9 +12,9 @@ struct VioCollector {
   /**
    * Main collection cycle.
    */
-  void gc(const std::set<Traceable *> &roots) {
+  void gc(const std::set<Traceable *> &roots, VioHeap &heap) {
     mark(roots);
-    sweep();
+    sweep(heap);
   }
 
   /**
@@ -55,18 +55,17 @@ struct VioCollector {
   /**
    * Sweep phase (reclaim).
    */
-  void sweep() {
-    auto it = Traceable::objects.begin();
-    while (it != Traceable::objects.end()) {
-      auto object = (Traceable*)*it;
+  void sweep(VioHeap &heap) {
+    auto live = heap.objects.begin();
+    for (auto &object: heap.objects) {
       if (object->marked) {
         object->marked=false; //for future collection cycle
-        ++it;
+        *live++ = object;
       } else {
-        it = Traceable::objects.erase(it);
         delete object;
       }
-   }
+    }
+    heap.objects.erase(live, heap.objects.end());
   }
 };
 
@@ -0,0 +1,312 @@
+/**
+ * Vio mid-level IR.
+ */
+
+#ifndef VioIR_h
+#define VioIR_h
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "../Logger.h"
+#include "../bytecode/OpCode.h"
+#include "../vm/VioValue.h"
+
+/**
+ * IR instruction: an opcode with a decoded operand, and for
+ * jumps the target block instead of a byte offset.
+ */
+struct IRInstruction {
+  uint8_t opcode;
+
+  /**
+   * Single-byte operand (const/local/global index, compare op, count).
+   */
+  uint8_t operand = 0;
+
+  /**
+   * Second operand: argument count of a direct call.
+   */
+  uint8_t count = 0;
+
+  /**
+   * Target block of a jump, -1 otherwise.
+   */
+  int target = -1;
+
+  /**
+   * Number of stack values consumed.
+   */
+  size_t pops() const {
+    switch (opcode) {
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_COMPARE:
+      case OP_ADD_NUM:
+      case OP_SUB_NUM:
+      case OP_MUL_NUM:
+      case OP_DIV_NUM:
+      case OP_LT_NUM:
+      case OP_GT_NUM:
+      case OP_EQ_NUM:
+      case OP_GE_NUM:
+      case OP_LE_NUM:
+      case OP_NE_NUM:
+      case OP_RESUME:
+        return 2;
+      case OP_JMP_IF_FALSE:
+      case OP_SET_GLOBAL:
+      case OP_SET_LOCAL:
+      case OP_POP:
+      case OP_HALT:
+      case OP_RETURN:
+      case OP_YIELD:
+        return 1;
+      case OP_SCOPE_EXIT:
+        return operand + 1;
+      case OP_CALL:
+        return operand + 1;
+      case OP_CALL_DIRECT:
+        return count;
+      default:
+        return 0;
+    }
+  }
+
+  /**
+   * Number of stack values produced.
+   */
+  size_t pushes() const {
+    switch (opcode) {
+      case OP_CONST:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_DIV:
+      case OP_COMPARE:
+      case OP_ADD_NUM:
+      case OP_SUB_NUM:
+      case OP_MUL_NUM:
+      case OP_DIV_NUM:
+      case OP_LT_NUM:
+      case OP_GT_NUM:
+      case OP_EQ_NUM:
+      case OP_GE_NUM:
+      case OP_LE_NUM:
+      case OP_NE_NUM:
+      case OP_GET_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_GET_LOCAL:
+      case OP_SET_LOCAL:
+      case OP_SCOPE_EXIT:
+      case OP_CALL:
+      case OP_CALL_DIRECT:
+      case OP_YIELD:
+      case OP_RESUME:
+        return 1;
+      default:
+        return 0;
+    }
+  }
+
+  bool isJump() const { return opcode == OP_JMP || opcode == OP_JMP_IF_FALSE; }
+
+  /**
+   * Instructions which never fall through.
+   */
+  bool isTerminator() const {
+    return opcode == OP_JMP || opcode == OP_RETURN || opcode == OP_HALT;
+  }
+};
+
+/**
+ * Basic block: straight-line code with a single entry.
+ */
+struct BasicBlock {
+  std::vector<IRInstruction> instructions;
+
+  /**
+   * Whether control falls through into the next block (by index).
+   */
+  bool fallsThrough() const {
+    return instructions.empty() || !instructions.back().isTerminator();
+  }
+
+  /**
+   * Whether the block is reachable from the entry.
+   */
+  bool reachable = true;
+};
+
+/**
+ * IR of one code object: a control-flow graph of basic blocks.
+ *
+ * Blocks are identified by their index; block `i` falls through
+ * into block `i + 1`. The emission order is kept separately in
+ * `layout`, so passes can reorder blocks without renumbering.
+ */
+struct IRFunction {
+  /**
+   * Code object this function is lowered into.
+   */
+  CodeObject* co;
+
+  std::vector<BasicBlock> blocks;
+
+  /**
+   * Order in which blocks are emitted.
+   */
+  std::vector<int> layout;
+
+  /**
+   * Successors of a block.
+   */
+  std::vector<int> successors(int index) const {
+    std::vector<int> result;
+    auto& block = blocks[index];
+    for (auto& instr : block.instructions) {
+      if (instr.isJump()) {
+        result.push_back(instr.target);
+      }
+    }
+    if (block.fallsThrough() && index + 1 < (int)blocks.size()) {
+      result.push_back(index + 1);
+    }
+    return result;
+  }
+};
+
+/**
+ * Converts between bytecode and the IR.
+ */
+class VioIRBuilder {
+ public:
+  /**
+   * Lifts bytecode of a code object into a CFG.
+   */
+  IRFunction lift(CodeObject* co) {
+    IRFunction fn;
+    fn.co = co;
+    auto& code = co->code;
+
+    // 1. Find block leaders.
+    std::set<size_t> leaders{0};
+    for (size_t offset = 0; offset < code.size();) {
+      auto opcode = code[offset];
+      auto size = opcodeSize(opcode);
+      if (opcode == OP_JMP || opcode == OP_JMP_IF_FALSE) {
+        leaders.insert(readWord(code, offset + 1));
+      }
+      if (opcode == OP_JMP || opcode == OP_JMP_IF_FALSE ||
+          opcode == OP_RETURN || opcode == OP_HALT) {
+        leaders.insert(offset + size);
+      }
+      offset += size;
+    }
+
+    std::map<size_t, int> blockByOffset;
+    for (auto leader : leaders) {
+      if (leader < code.size()) {
+        blockByOffset[leader] = blockByOffset.size();
+      }
+    }
+
+    // 2. Decode instructions into blocks.
+    fn.blocks.assign(blockByOffset.size(), BasicBlock{});
+    int current = -1;
+    for (size_t offset = 0; offset < code.size();) {
+      auto it = blockByOffset.find(offset);
+      if (it != blockByOffset.end()) {
+        current = it->second;
+      }
+
+      IRInstruction instr;
+      instr.opcode = code[offset];
+      auto size = opcodeSize(instr.opcode);
+      if (instr.isJump()) {
+        instr.target = blockByOffset.at(readWord(code, offset + 1));
+      } else if (size >= 2) {
+        instr.operand = code[offset + 1];
+        if (size == 3) {
+          instr.count = code[offset + 2];
+        }
+      }
+      fn.blocks[current].instructions.push_back(instr);
+      offset += size;
+    }
+
+    for (size_t i = 0; i < fn.blocks.size(); i++) {
+      fn.layout.push_back(i);
+    }
+    return fn;
+  }
+
+  /**
+   * Lowers the IR back to bytecode in the `layout` order.
+   */
+  std::vector<uint8_t> lower(IRFunction& fn) {
+    auto& order = fn.layout;
+
+    // Fix up block ends for the layout: explicit jumps where the
+    // fallthrough block isn't next, no jumps to the next block.
+    for (size_t i = 0; i < order.size(); i++) {
+      auto& block = fn.blocks[order[i]];
+      auto next = i + 1 < order.size() ? order[i + 1] : -1;
+
+      if (block.fallsThrough()) {
+        if (next != order[i] + 1 && order[i] + 1 < (int)fn.blocks.size()) {
+          IRInstruction jmp;
+          jmp.opcode = OP_JMP;
+          jmp.target = order[i] + 1;
+          block.instructions.push_back(jmp);
+        }
+      } else if (block.instructions.back().opcode == OP_JMP &&
+                 block.instructions.back().target == next) {
+        block.instructions.pop_back();
+      }
+    }
+
+    // Block offsets in the layout.
+    std::vector<size_t> offsets(fn.blocks.size(), 0);
+    size_t offset = 0;
+    for (auto index : order) {
+      offsets[index] = offset;
+      for (auto& instr : fn.blocks[index].instructions) {
+        offset += opcodeSize(instr.opcode);
+      }
+    }
+    if (offset > UINT16_MAX) {
+      DIE << "[VioIRBuilder]: code object " << fn.co->name
+          << " exceeds the jump range";
+    }
+
+    std::vector<uint8_t> code;
+    code.reserve(offset);
+    for (auto index : order) {
+      for (auto& instr : fn.blocks[index].instructions) {
+        code.push_back(instr.opcode);
+        if (instr.isJump()) {
+          auto address = offsets[instr.target];
+          code.push_back((address >> 8) & 0xff);
+          code.push_back(address & 0xff);
+        } else if (opcodeSize(instr.opcode) >= 2) {
+          code.push_back(instr.operand);
+          if (opcodeSize(instr.opcode) == 3) {
+            code.push_back(instr.count);
+          }
+        }
+      }
+    }
+    return code;
+  }
+
+ private:
+  uint16_t readWord(const std::vector<uint8_t>& code, size_t offset) {
+    return (uint16_t)((code[offset] << 8) | code[offset + 1]);
+  }
+};
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * Loop analysis over the IR.
+ */
+
+#ifndef VioLoops_h
+#define VioLoops_h
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "VioIR.h"
+
+/**
+ * Natural loop: a header and the blocks which reach a back
+ * edge to the header without passing through it.
+ */
+struct Loop {
+  int header;
+  std::set<int> blocks;
+
+  /**
+   * Blocks with a back edge to the header.
+   */
+  std::vector<int> latches;
+};
+
+/**
+ * Control-flow analysis of an IR function: predecessors,
+ * dominator tree, natural loops and operand stack depths.
+ */
+class VioLoopInfo {
+ public:
+  VioLoopInfo(const IRFunction& fn) : fn_(fn) {
+    computeOrder();
+    computeDominators();
+    computeLoops();
+  }
+
+  /**
+   * Natural loops, innermost (smallest) first.
+   */
+  const std::vector<Loop>& loops() const { return loops_; }
+
+  /**
+   * Whether block `a` dominates block `b`.
+   */
+  bool dominates(int a, int b) const {
+    if (idom_[b] == -1) {
+      return false;
+    }
+    for (;;) {
+      if (a == b) {
+        return true;
+      }
+      if (b == 0) {
+        return false;
+      }
+      b = idom_[b];
+    }
+  }
+
+  /**
+   * Operand stack depth at the entry of each block, relative to the
+   * frame base (which is also the local slot numbering). Returns an
+   * empty vector if the depths don't agree at some join.
+   */
+  std::vector<int> stackDepths() const {
+    auto co = fn_.co;
+    int base = co->name == "main" ? 0 : co->arity;
+
+    std::vector<int> depths(fn_.blocks.size(), -1);
+    depths[0] = base;
+    for (auto index : order_) {
+      auto depth = depths[index];
+      auto& block = fn_.blocks[index];
+      for (auto& instr : block.instructions) {
+        depth += (int)instr.pushes() - (int)instr.pops();
+      }
+      for (auto succ : fn_.successors(index)) {
+        if (depths[succ] == -1) {
+          depths[succ] = depth;
+        } else if (depths[succ] != depth) {
+          return {};
+        }
+      }
+    }
+    return depths;
+  }
+
+ private:
+  /**
+   * Reverse post-order of blocks reachable from the entry.
+   */
+  void computeOrder() {
+    std::vector<bool> visited(fn_.blocks.size(), false);
+    std::vector<std::pair<int, size_t>> stack{{0, 0}};
+    visited[0] = true;
+
+    while (!stack.empty()) {
+      auto& [index, next] = stack.back();
+      auto succs = fn_.successors(index);
+      if (next < succs.size()) {
+        auto succ = succs[next++];
+        if (!visited[succ]) {
+          visited[succ] = true;
+          stack.push_back({succ, 0});
+        }
+        continue;
+      }
+      order_.push_back(index);
+      stack.pop_back();
+    }
+    std::reverse(order_.begin(), order_.end());
+
+    rpoNumber_.assign(fn_.blocks.size(), -1);
+    preds_.assign(fn_.blocks.size(), {});
+    for (size_t i = 0; i < order_.size(); i++) {
+      rpoNumber_[order_[i]] = i;
+      for (auto succ : fn_.successors(order_[i])) {
+        preds_[succ].push_back(order_[i]);
+      }
+    }
+  }
+
+  /**
+   * Immediate dominators (Cooper, Harvey, Kennedy).
+   */
+  void computeDominators() {
+    idom_.assign(fn_.blocks.size(), -1);
+    idom_[0] = 0;
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 1; i < order_.size(); i++) {
+        auto index = order_[i];
+        int newIdom = -1;
+        for (auto pred : preds_[index]) {
+          if (idom_[pred] == -1) {
+            continue;
+          }
+          newIdom = newIdom == -1 ? pred : intersect(pred, newIdom);
+        }
+        if (idom_[index] != newIdom) {
+          idom_[index] = newIdom;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  int intersect(int a, int b) {
+    while (a != b) {
+      while (rpoNumber_[a] > rpoNumber_[b]) {
+        a = idom_[a];
+      }
+      while (rpoNumber_[b] > rpoNumber_[a]) {
+        b = idom_[b];
+      }
+    }
+    return a;
+  }
+
+  /**
+   * Collects natural loops of back edges, merged by header.
+   */
+  void computeLoops() {
+    std::map<int, Loop> byHeader;
+
+    for (auto index : order_) {
+      for (auto succ : fn_.successors(index)) {
+        if (!dominates(succ, index)) {
+          continue;
+        }
+        auto& loop = byHeader[succ];
+        loop.header = succ;
+        loop.latches.push_back(index);
+        loop.blocks.insert(succ);
+
+        std::vector<int> worklist{index};
+        while (!worklist.empty()) {
+          auto block = worklist.back();
+          worklist.pop_back();
+          if (!loop.blocks.insert(block).second) {
+            continue;
+          }
+          for (auto pred : preds_[block]) {
+            worklist.push_back(pred);
+          }
+        }
+      }
+    }
+
+    for (auto& [header, loop] : byHeader) {
+      loops_.push_back(loop);
+    }
+    std::stable_sort(loops_.begin(), loops_.end(),
+                     [](const Loop& a, const Loop& b) {
+                       return a.blocks.size() < b.blocks.size();
+                     });
+  }
+
+  const IRFunction& fn_;
+
+  /**
+   * Reachable blocks in reverse post-order.
+   */
+  std::vector<int> order_;
+
+  std::vector<int> rpoNumber_;
+
+  std::vector<std::vector<int>> preds_;
+
+  /**
+   * Immediate dominator of each block, -1 if unreachable.
+   */
+  std::vector<int> idom_;
+
+  std::vector<Loop> loops_;
+};
+
+#endif
@@ -0,0 +1,86 @@
+/**
+ * IR pass manager.
+ */
+
+#ifndef VioPassManager_h
+#define VioPassManager_h
+
+#include <memory>
+#include <vector>
+
+#include "VioIR.h"
+#include "VioPasses.h"
+
+/**
+ * Optimization levels:
+ *
+ *   -O0: no optimizations,
+ *   -O1: AST constant folding, peephole, unreachable blocks,
+ *   -O2: all of -O1, inlining, jump threading, loop-invariant code
+ *        motion and block layout.
+ */
+enum class OptLevel {
+  O0 = 0,
+  O1 = 1,
+  O2 = 2,
+};
+
+/**
+ * Runs a pipeline of passes over the IR of code objects.
+ */
+class VioPassManager {
+ public:
+  /**
+   * Adds a pass to the end of the pipeline.
+   */
+  void addPass(std::unique_ptr<VioPass> pass) {
+    passes_.push_back(std::move(pass));
+  }
+
+  /**
+   * Builds the default pipeline for an optimization level.
+   */
+  void buildPipeline(OptLevel level) {
+    passes_.clear();
+
+    if (level >= OptLevel::O2) {
+      addPass(std::make_unique<JumpThreadingPass>());
+      addPass(std::make_unique<LoopInvariantCodeMotionPass>());
+    }
+    if (level >= OptLevel::O1) {
+      addPass(std::make_unique<PeepholePass>());
+      addPass(std::make_unique<UnreachableBlockPass>());
+    }
+    if (level >= OptLevel::O2) {
+      addPass(std::make_unique<BlockLayoutPass>());
+    }
+  }
+
+  /**
+   * Lifts the code object into the IR, runs all passes
+   * and lowers it back to bytecode.
+   */
+  void run(CodeObject* co) {
+    if (passes_.empty() || co->code.empty()) {
+      return;
+    }
+    auto fn = builder_.lift(co);
+    for (auto& pass : passes_) {
+      pass->run(fn);
+    }
+    co->code = builder_.lower(fn);
+  }
+
+ private:
+  /**
+   * IR builder.
+   */
+  VioIRBuilder builder_;
+
+  /**
+   * Pipeline.
+   */
+  std::vector<std::unique_ptr<VioPass>> passes_;
+};
+
+#endif
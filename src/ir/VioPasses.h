@@ -0,0 +1,552 @@
+/**
+ * IR optimization passes.
+ */
+
+#ifndef VioPasses_h
+#define VioPasses_h
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "VioIR.h"
+#include "VioLoops.h"
+
+/**
+ * Base optimization pass over the IR of one code object.
+ */
+struct VioPass {
+  virtual ~VioPass() {}
+
+  /**
+   * Pass name.
+   */
+  virtual std::string name() = 0;
+
+  /**
+   * Runs the pass, returns whether the IR changed.
+   */
+  virtual bool run(IRFunction& fn) = 0;
+};
+
+// -----------------------------------------------------------------
+
+/**
+ * Drops `<pure push>; OP_POP` pairs and `OP_SCOPE_EXIT 0` within blocks.
+ */
+struct PeepholePass : public VioPass {
+  std::string name() override { return "peephole"; }
+
+  bool run(IRFunction& fn) override {
+    bool changed = false;
+    for (auto& block : fn.blocks) {
+      std::vector<IRInstruction> result;
+      for (auto& instr : block.instructions) {
+        if (instr.opcode == OP_POP && !result.empty() &&
+            isPurePush(result.back().opcode)) {
+          result.pop_back();
+          changed = true;
+          continue;
+        }
+        if (instr.opcode == OP_SCOPE_EXIT && instr.operand == 0) {
+          changed = true;
+          continue;
+        }
+        result.push_back(instr);
+      }
+      block.instructions = result;
+    }
+    return changed;
+  }
+
+  /**
+   * Instructions which only push a value, without side effects.
+   */
+  static bool isPurePush(uint8_t opcode) {
+    return opcode == OP_CONST || opcode == OP_GET_LOCAL ||
+           opcode == OP_GET_GLOBAL;
+  }
+};
+
+// -----------------------------------------------------------------
+
+/**
+ * Removes blocks which are not reachable from the entry.
+ */
+struct UnreachableBlockPass : public VioPass {
+  std::string name() override { return "unreachable-blocks"; }
+
+  bool run(IRFunction& fn) override {
+    for (auto& block : fn.blocks) {
+      block.reachable = false;
+    }
+
+    std::vector<int> worklist{0};
+    while (!worklist.empty()) {
+      auto index = worklist.back();
+      worklist.pop_back();
+      if (fn.blocks[index].reachable) {
+        continue;
+      }
+      fn.blocks[index].reachable = true;
+      for (auto succ : fn.successors(index)) {
+        worklist.push_back(succ);
+      }
+    }
+
+    std::vector<int> layout;
+    for (auto index : fn.layout) {
+      if (fn.blocks[index].reachable) {
+        layout.push_back(index);
+      }
+    }
+    bool changed = layout.size() != fn.layout.size();
+    fn.layout = layout;
+    return changed;
+  }
+};
+
+// -----------------------------------------------------------------
+
+/**
+ * Retargets jumps whose target block starts with an unconditional jump.
+ */
+struct JumpThreadingPass : public VioPass {
+  std::string name() override { return "jump-threading"; }
+
+  bool run(IRFunction& fn) override {
+    bool changed = false;
+    for (auto& block : fn.blocks) {
+      for (auto& instr : block.instructions) {
+        if (!instr.isJump()) {
+          continue;
+        }
+        // Bounded by the number of blocks to stop on `while true` cycles.
+        for (size_t hops = 0; hops < fn.blocks.size(); hops++) {
+          auto& target = fn.blocks[instr.target].instructions;
+          if (target.empty() || target.front().opcode != OP_JMP ||
+              target.front().target == instr.target) {
+            break;
+          }
+          instr.target = target.front().target;
+          changed = true;
+        }
+      }
+    }
+    return changed;
+  }
+};
+
+// -----------------------------------------------------------------
+
+/**
+ * Orders blocks along fallthrough chains. A block reached only by an
+ * unconditional jump is pulled right after the jump, so the hot path
+ * falls through and the jump disappears on lowering.
+ */
+struct BlockLayoutPass : public VioPass {
+  std::string name() override { return "block-layout"; }
+
+  bool run(IRFunction& fn) override {
+    std::set<int> inLayout(fn.layout.begin(), fn.layout.end());
+
+    // Blocks which some laid out block falls into.
+    std::set<int> hasFallthroughPred;
+    for (auto index : fn.layout) {
+      if (fn.blocks[index].fallsThrough()) {
+        hasFallthroughPred.insert(index + 1);
+      }
+    }
+
+    std::vector<int> order;
+    std::set<int> placed;
+
+    for (auto start : fn.layout) {
+      auto current = start;
+      while (current != -1 && inLayout.count(current) != 0 &&
+             placed.count(current) == 0) {
+        placed.insert(current);
+        order.push_back(current);
+
+        auto& block = fn.blocks[current];
+        if (block.fallsThrough()) {
+          current = current + 1;
+        } else if (block.instructions.back().opcode == OP_JMP &&
+                   hasFallthroughPred.count(
+                       block.instructions.back().target) == 0) {
+          current = block.instructions.back().target;
+        } else {
+          current = -1;
+        }
+      }
+    }
+
+    bool changed = order != fn.layout;
+    fn.layout = order;
+    return changed;
+  }
+};
+
+// -----------------------------------------------------------------
+
+/**
+ * Loop-invariant code motion.
+ *
+ * Pure computations (consts, arithmetic and comparisons of locals and
+ * globals) which don't depend on the loop are evaluated once in a
+ * preheader. Variables change only through OP_SET_LOCAL/OP_SET_GLOBAL,
+ * and globals also in callees, so a read is invariant iff the loop
+ * has no such store (or, for globals, no calls).
+ *
+ * Hoisted values live in new stack slots right above the locals which
+ * are live at the loop entry, locals declared in the loop move up:
+ *
+ *   preheader:  <invariant>             ; slot D
+ *   loop:       ... GET_LOCAL D ...
+ *   exit:       POP                     ; drops slot D
+ *
+ * Only blocks which run on every iteration are hoisted from.
+ */
+struct LoopInvariantCodeMotionPass : public VioPass {
+  std::string name() override { return "licm"; }
+
+  bool run(IRFunction& fn) override {
+    bool changed = false;
+    std::set<int> visited;
+
+    // Hoisting changes the CFG, so the loops are recomputed each time;
+    // inner loops go first, and their preheaders are hoisted further
+    // when the outer loop is processed.
+    for (;;) {
+      VioLoopInfo info(fn);
+      const Loop* next = nullptr;
+      for (auto& loop : info.loops()) {
+        if (visited.count(loop.header) == 0) {
+          next = &loop;
+          break;
+        }
+      }
+      if (next == nullptr) {
+        break;
+      }
+      visited.insert(next->header);
+
+      // The hoisted loop gets a new header, see `hoist`.
+      auto header = (int)fn.blocks.size();
+      if (hoist(fn, info, *next)) {
+        visited.insert(header);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+ private:
+  /**
+   * Instruction range [start, end) of a block.
+   */
+  struct Range {
+    int block;
+    size_t start;
+    size_t end;
+  };
+
+  /**
+   * Value on the symbolic operand stack.
+   */
+  struct Value {
+    size_t start;
+    size_t end;
+    bool invariant;
+
+    /**
+     * Whether it's computed (not a single load).
+     */
+    bool computed;
+  };
+
+  bool hoist(IRFunction& fn, const VioLoopInfo& info, const Loop& loop) {
+    auto depths = info.stackDepths();
+    if (depths.empty()) {
+      return false;
+    }
+    auto slot = depths[loop.header];
+
+    // Stores in the loop.
+    std::set<uint8_t> setLocals;
+    std::set<uint8_t> setGlobals;
+    bool hasCall = false;
+    for (auto index : loop.blocks) {
+      for (auto& instr : fn.blocks[index].instructions) {
+        switch (instr.opcode) {
+          case OP_SET_LOCAL:
+            setLocals.insert(instr.operand);
+            break;
+          case OP_SET_GLOBAL:
+            setGlobals.insert(instr.operand);
+            break;
+          case OP_CALL:
+          case OP_CALL_DIRECT:
+          // other fibers run until it continues
+          case OP_YIELD:
+          case OP_RESUME:
+            hasCall = true;
+            break;
+          case OP_RETURN:
+          case OP_HALT:
+            return false;
+        }
+      }
+    }
+
+    auto isInvariant = [&](const IRInstruction& instr) {
+      switch (instr.opcode) {
+        case OP_CONST:
+          return true;
+        case OP_GET_LOCAL:
+          return instr.operand < slot && setLocals.count(instr.operand) == 0;
+        case OP_GET_GLOBAL:
+          return !hasCall && setGlobals.count(instr.operand) == 0;
+      }
+      return false;
+    };
+
+    // A loop whose header tests the condition is rotated: its test is
+    // copied before the hoisted code, so the code only runs when the
+    // loop is entered. Otherwise only the header's code is hoisted,
+    // since the rest of the loop may run zero times.
+    auto& header = fn.blocks[loop.header].instructions;
+    auto rotated = !header.empty() &&
+                   header.back().opcode == OP_JMP_IF_FALSE &&
+                   loop.blocks.count(header.back().target) == 0 &&
+                   loop.blocks.count(loop.header + 1) != 0;
+    auto entryTest = header;
+
+    // Maximal invariant computations in blocks run on every iteration.
+    std::vector<Range> ranges;
+    for (auto index : loop.blocks) {
+      bool always = rotated || index == loop.header;
+      for (auto latch : loop.latches) {
+        always = always && info.dominates(index, latch);
+      }
+      if (always) {
+        collect(fn.blocks[index], index, isInvariant, ranges);
+      }
+    }
+    if (ranges.empty()) {
+      return false;
+    }
+    std::sort(ranges.begin(), ranges.end(),
+              [](const Range& a, const Range& b) {
+                return a.block < b.block ||
+                       (a.block == b.block && a.start < b.start);
+              });
+
+    std::set<int> exits;
+    for (auto index : loop.blocks) {
+      for (auto succ : fn.successors(index)) {
+        if (loop.blocks.count(succ) == 0) {
+          exits.insert(succ);
+        }
+      }
+    }
+    for (auto exit : exits) {
+      if (exit == 0 || depths[exit] != slot) {
+        return false;
+      }
+    }
+
+    // One slot per distinct computation.
+    std::map<std::vector<std::pair<uint8_t, uint8_t>>, size_t> slotByKey;
+    std::vector<std::vector<IRInstruction>> hoisted;
+    std::vector<size_t> slots;
+    for (auto& range : ranges) {
+      auto& instructions = fn.blocks[range.block].instructions;
+      std::vector<std::pair<uint8_t, uint8_t>> key;
+      for (auto i = range.start; i < range.end; i++) {
+        key.push_back({instructions[i].opcode, instructions[i].operand});
+      }
+      auto it = slotByKey.find(key);
+      if (it == slotByKey.end()) {
+        it = slotByKey.insert({key, slot + hoisted.size()}).first;
+        hoisted.emplace_back(instructions.begin() + range.start,
+                             instructions.begin() + range.end);
+      }
+      slots.push_back(it->second);
+    }
+    auto count = (int)hoisted.size();
+
+    // Local indices are single bytes.
+    for (auto index : loop.blocks) {
+      for (auto& instr : fn.blocks[index].instructions) {
+        if ((instr.opcode == OP_GET_LOCAL || instr.opcode == OP_SET_LOCAL) &&
+            instr.operand >= slot && instr.operand + count > UINT8_MAX) {
+          return false;
+        }
+      }
+    }
+    if (slot + count > UINT8_MAX) {
+      return false;
+    }
+
+    // Locals declared in the loop move above the new slots.
+    for (auto index : loop.blocks) {
+      for (auto& instr : fn.blocks[index].instructions) {
+        if ((instr.opcode == OP_GET_LOCAL || instr.opcode == OP_SET_LOCAL) &&
+            instr.operand >= slot) {
+          instr.operand += count;
+        }
+      }
+    }
+
+    // Replace the computations with loads, from the end of each block.
+    for (int i = ranges.size() - 1; i >= 0; i--) {
+      auto& range = ranges[i];
+      auto& instructions = fn.blocks[range.block].instructions;
+      IRInstruction load;
+      load.opcode = OP_GET_LOCAL;
+      load.operand = slots[i];
+      instructions.erase(instructions.begin() + range.start,
+                         instructions.begin() + range.end);
+      instructions.insert(instructions.begin() + range.start, load);
+    }
+
+    // The header's code moves to a new block and the header becomes
+    // the preheader, so entries into the loop pass through it.
+    auto body = (int)fn.blocks.size();
+    auto moved = fn.blocks[loop.header];
+    if (moved.fallsThrough()) {
+      moved.instructions.push_back(jump(loop.header + 1));
+    }
+    fn.blocks.push_back(moved);
+
+    auto& preheader = fn.blocks[loop.header].instructions;
+    preheader.clear();
+    if (rotated) {
+      // the first test exits before the slots are pushed
+      preheader = entryTest;
+    }
+    for (auto& instructions : hoisted) {
+      preheader.insert(preheader.end(), instructions.begin(),
+                       instructions.end());
+    }
+    preheader.push_back(jump(rotated ? loop.header + 1 : body));
+
+    auto position =
+        std::find(fn.layout.begin(), fn.layout.end(), loop.header);
+    fn.layout.insert(position + 1, body);
+
+    auto blocks = loop.blocks;
+    blocks.erase(loop.header);
+    blocks.insert(body);
+    for (auto index : blocks) {
+      redirect(fn, index, loop.header, body);
+    }
+
+    // Exits drop the slots.
+    for (auto exit : exits) {
+      BasicBlock block;
+      for (int i = 0; i < count; i++) {
+        IRInstruction pop;
+        pop.opcode = OP_POP;
+        block.instructions.push_back(pop);
+      }
+      block.instructions.push_back(jump(exit));
+
+      auto index = (int)fn.blocks.size();
+      fn.blocks.push_back(block);
+      auto position = std::find(fn.layout.begin(), fn.layout.end(), exit);
+      fn.layout.insert(position, index);
+
+      for (auto block : blocks) {
+        redirect(fn, block, exit, index);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Collects maximal invariant computations of a block.
+   */
+  template <typename Predicate>
+  void collect(const BasicBlock& block, int index, Predicate isInvariant,
+               std::vector<Range>& ranges) {
+    std::vector<Value> stack;
+
+    auto record = [&](const Value& value) {
+      if (value.invariant && value.computed) {
+        ranges.push_back({index, value.start, value.end});
+      }
+    };
+
+    auto& instructions = block.instructions;
+    for (size_t i = 0; i < instructions.size(); i++) {
+      auto& instr = instructions[i];
+      if (isArithmetic(instr.opcode) && stack.size() >= 2) {
+        auto op2 = stack.back();
+        stack.pop_back();
+        auto op1 = stack.back();
+        stack.pop_back();
+        auto invariant = op1.invariant && op2.invariant;
+        if (!invariant) {
+          record(op1);
+          record(op2);
+        }
+        stack.push_back({op1.start, i + 1, invariant, true});
+        continue;
+      }
+
+      // Values from predecessors aren't tracked.
+      if (instr.pops() > stack.size()) {
+        for (auto& value : stack) {
+          record(value);
+        }
+        stack.clear();
+      } else {
+        for (size_t j = 0; j < instr.pops(); j++) {
+          record(stack.back());
+          stack.pop_back();
+        }
+      }
+      for (size_t j = 0; j < instr.pushes(); j++) {
+        stack.push_back({i, i + 1, isInvariant(instr), false});
+      }
+    }
+    for (auto& value : stack) {
+      record(value);
+    }
+  }
+
+  static bool isArithmetic(uint8_t opcode) {
+    return opcode == OP_ADD || opcode == OP_SUB || opcode == OP_MUL ||
+           opcode == OP_DIV || opcode == OP_COMPARE;
+  }
+
+  static IRInstruction jump(int target) {
+    IRInstruction jmp;
+    jmp.opcode = OP_JMP;
+    jmp.target = target;
+    return jmp;
+  }
+
+  /**
+   * Retargets edges of a block from `from` to `to`.
+   */
+  void redirect(IRFunction& fn, int index, int from, int to) {
+    auto& block = fn.blocks[index];
+    auto fallsInto = block.fallsThrough() && index + 1 == from;
+    for (auto& instr : block.instructions) {
+      if (instr.isJump() && instr.target == from) {
+        instr.target = to;
+      }
+    }
+    if (fallsInto) {
+      block.instructions.push_back(jump(to));
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * Background JIT compilation.
+ */
+
+#ifndef VioCompilerThread_h
+#define VioCompilerThread_h
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../vm/VioValue.h"
+#include "VioJit.h"
+
+/**
+ * Compiles hot code objects on a background thread while the
+ * interpreter keeps running.
+ *
+ * A request is a copy of the bytecode taken on the VM thread, since
+ * the interpreter keeps quickening the code in place. The native code
+ * is published to `CodeObject::compiled`, and the VM installs it at
+ * the next call (or loop back edge) of the code object.
+ */
+class VioCompilerThread {
+ public:
+  ~VioCompilerThread() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  /**
+   * Queues the code object for compilation, starting the thread on
+   * the first request.
+   */
+  void submit(CodeObject* co, size_t globalsCount) {
+    Request request{co,
+                    std::vector<uint8_t>(co->codeBegin(),
+                                         co->codeBegin() + co->codeSize()),
+                    co->constants.size(), globalsCount};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(request));
+      if (!thread_.joinable()) {
+        thread_ = std::thread([this]() { work(); });
+      }
+    }
+    ready_.notify_one();
+  }
+
+  /**
+   * Waits until all submitted code objects are compiled.
+   */
+  void drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return queue_.empty() && !busy_; });
+  }
+
+ private:
+  struct Request {
+    CodeObject* co;
+    std::vector<uint8_t> code;
+    size_t constantsCount;
+    size_t globalsCount;
+  };
+
+  /**
+   * Compiler thread loop.
+   */
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      auto request = std::move(queue_.front());
+      queue_.pop_front();
+      busy_ = true;
+      lock.unlock();
+
+      auto native = jit_.compile(request.code.data(), request.code.size(),
+                                 request.constantsCount, request.globalsCount);
+      if (native != nullptr) {
+        request.co->compiled.store(native, std::memory_order_release);
+      }
+
+      lock.lock();
+      busy_ = false;
+      if (queue_.empty()) {
+        idle_.notify_all();
+      }
+    }
+  }
+
+  /**
+   * JIT, only used on the compiler thread. Owns the native code.
+   */
+  VioJit jit_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable idle_;
+  std::deque<Request> queue_;
+  bool busy_ = false;
+  bool stopping_ = false;
+};
+
+#endif
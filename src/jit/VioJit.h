@@ -0,0 +1,280 @@
+/**
+ * Copy-and-patch x86-64 JIT.
+ */
+
+#ifndef VioJit_h
+#define VioJit_h
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "../bytecode/OpCode.h"
+#include "../vm/VioValue.h"
+#include "VioStencils.h"
+
+/**
+ * Native code of a code object, in executable memory.
+ */
+struct NativeCode {
+  NativeCode(uint8_t* memory, size_t size) : memory(memory), size(size) {}
+
+  ~NativeCode() { munmap(memory, size); }
+
+  /**
+   * Runs from the instruction at bytecode `offset` until an exit,
+   * returns the bytecode offset of the instruction to interpret.
+   */
+  size_t run(JitState* state, size_t offset) {
+    if (offset >= entries.size() || entries[offset] == UINT32_MAX) {
+      return offset;
+    }
+    auto enter = (uint32_t(*)(JitState*, const uint8_t*))memory;
+    return enter(state, memory + entries[offset]);
+  }
+
+  uint8_t* memory;
+  size_t size;
+
+  /**
+   * Native offset of each bytecode instruction, UINT32_MAX
+   * for offsets inside instructions.
+   */
+  std::vector<uint32_t> entries;
+
+  /**
+   * Max values pushed from any entry (free stack needed to enter).
+   */
+  size_t maxStack = 0;
+};
+
+/**
+ * Copy-and-patch JIT: the native code of a code object is the
+ * concatenation of the stencils of its instructions (see VioStencils),
+ * with holes patched: operands, jump targets and exits. Compiling is
+ * a copy per instruction, so it takes microseconds per function.
+ *
+ * Layout: entry, instructions, exit stubs of the instructions with
+ * guards, exit sequence. A failed guard, and instructions without a
+ * stencil (calls, returns, halt), exit to the interpreter at that
+ * instruction.
+ */
+class VioJit {
+ public:
+  /**
+   * Whether native code exits at the opcode when a guard fails (its
+   * operands aren't numbers), rather than always.
+   */
+  static bool guards(uint8_t opcode) {
+    return (opcode >= OP_ADD && opcode <= OP_COMPARE) ||
+           (opcode >= OP_ADD_NUM && opcode <= OP_NE_NUM);
+  }
+
+  /**
+   * Compiles the code object, returns nullptr if it can't.
+   */
+  NativeCode* compile(CodeObject* co, size_t globalsCount) {
+    return compile(co->codeBegin(), co->codeSize(), co->constants.size(),
+                   globalsCount);
+  }
+
+  /**
+   * Compiles bytecode with `constantsCount` constants (e.g. a copy
+   * of a code object's), returns nullptr if it can't.
+   */
+  NativeCode* compile(const uint8_t* code, size_t size, size_t constantsCount,
+                      size_t globalsCount) {
+    if (size == 0 || size >= UINT32_MAX) {
+      return nullptr;
+    }
+
+    // 1. Instruction starts.
+    std::vector<uint32_t> entries(size, UINT32_MAX);
+    size_t last = 0;
+    for (size_t offset = 0; offset < size; offset += opcodeSize(code[offset])) {
+      entries[offset] = 0;
+      last = offset;
+    }
+    // Running off the end is left to the interpreter.
+    if (code[last] != OP_HALT && code[last] != OP_RETURN &&
+        code[last] != OP_JMP) {
+      return nullptr;
+    }
+
+    // 2. Stencils and their layout.
+    struct Placed {
+      size_t offset;
+      const Stencil* stencil;
+      size_t at;
+      size_t exitAt;
+    };
+    std::vector<Placed> placed;
+    size_t at = stencils_.entry.code.size();
+    for (size_t offset = 0; offset < size; offset += opcodeSize(code[offset])) {
+      auto& stencil = select(code, size, offset, entries, constantsCount,
+                             globalsCount);
+      placed.push_back({offset, &stencil, at, 0});
+      at += stencil.code.size();
+    }
+    for (auto& instr : placed) {
+      entries[instr.offset] = instr.at;
+      if (instr.stencil->exits()) {
+        instr.exitAt = at;
+        at += stencils_.exit.code.size();
+      }
+    }
+    auto tailAt = at;
+    at += stencils_.tail.code.size();
+
+    auto native = allocate(at);
+    if (native == nullptr) {
+      return nullptr;
+    }
+
+    // 3. Copy and patch.
+    auto memory = native->memory;
+    copy(memory, stencils_.entry, 0, {});
+    for (auto& instr : placed) {
+      Patch patch{code[instr.offset + 1 < size ? instr.offset + 1 : 0],
+                  instr.offset, 0, instr.exitAt, tailAt};
+      auto target = jumpTarget(code, instr.offset);
+      if (target < size) {
+        patch.targetAt = entries[target];
+      }
+      copy(memory, *instr.stencil, instr.at, patch);
+      if (instr.exitAt != 0) {
+        copy(memory, stencils_.exit, instr.exitAt, patch);
+      }
+    }
+    copy(memory, stencils_.tail, tailAt, {});
+
+    if (mprotect(memory, native->size, PROT_READ | PROT_EXEC) != 0) {
+      return nullptr;
+    }
+    native->entries = std::move(entries);
+    // each instruction pushes at most one value
+    native->maxStack = placed.size();
+
+    code_.push_back(std::move(native));
+    return code_.back().get();
+  }
+
+ private:
+  /**
+   * Values of the holes of an instruction's stencils.
+   */
+  struct Patch {
+    uint8_t operand;
+    size_t offset;
+    size_t targetAt;
+    size_t exitAt;
+    size_t tailAt;
+  };
+
+  /**
+   * Stencil of the instruction at `offset`: the exit stub if its
+   * operand is out of range.
+   */
+  const Stencil& select(const uint8_t* code, size_t size, size_t offset,
+                        const std::vector<uint32_t>& entries,
+                        size_t constantsCount, size_t globalsCount) {
+    auto opcode = code[offset];
+    if (offset + opcodeSize(opcode) > size) {
+      return stencils_.exit;
+    }
+    size_t operand = opcodeSize(opcode) > 1 ? code[offset + 1] : 0;
+
+    switch (opcode) {
+      case OP_CONST:
+        if (operand >= constantsCount) {
+          return stencils_.exit;
+        }
+        break;
+      case OP_GET_GLOBAL:
+      case OP_SET_GLOBAL:
+        if (operand >= globalsCount) {
+          return stencils_.exit;
+        }
+        break;
+      case OP_JMP:
+      case OP_JMP_IF_FALSE: {
+        auto target = jumpTarget(code, offset);
+        if (target >= size || entries[target] == UINT32_MAX) {
+          return stencils_.exit;
+        }
+        break;
+      }
+    }
+    return stencils_.of(opcode, operand);
+  }
+
+  /**
+   * Copies the stencil to `at` and patches its holes.
+   */
+  void copy(uint8_t* memory, const Stencil& stencil, size_t at,
+            const Patch& patch) {
+    memcpy(memory + at, stencil.code.data(), stencil.code.size());
+    for (auto& hole : stencil.holes) {
+      auto field = at + hole.at;
+      int32_t value = 0;
+      switch (hole.kind) {
+        case HoleKind::OPERAND:
+          value = patch.operand * hole.scale + hole.addend;
+          break;
+        case HoleKind::TARGET:
+          value = patch.targetAt - (field + 4);
+          break;
+        case HoleKind::EXIT:
+          value = patch.exitAt - (field + 4);
+          break;
+        case HoleKind::OFFSET:
+          value = patch.offset;
+          break;
+        case HoleKind::TAIL:
+          value = patch.tailAt - (field + 4);
+          break;
+      }
+      memcpy(memory + field, &value, 4);
+    }
+  }
+
+  /**
+   * Target offset of the jump at `offset`, SIZE_MAX if not a jump.
+   */
+  static size_t jumpTarget(const uint8_t* code, size_t offset) {
+    if (code[offset] != OP_JMP && code[offset] != OP_JMP_IF_FALSE) {
+      return SIZE_MAX;
+    }
+    return (size_t)((code[offset + 1] << 8) | code[offset + 2]);
+  }
+
+  /**
+   * Allocates writable memory for `size` bytes of code, made
+   * executable once written.
+   */
+  std::unique_ptr<NativeCode> allocate(size_t size) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size = (size + pageSize - 1) / pageSize * pageSize;
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+    return std::make_unique<NativeCode>((uint8_t*)memory, size);
+  }
+
+  /**
+   * Stencil library, assembled once.
+   */
+  VioStencils stencils_;
+
+  /**
+   * Compiled code, owned for the lifetime of the JIT.
+   */
+  std::vector<std::unique_ptr<NativeCode>> code_;
+};
+
+#endif
@@ -0,0 +1,446 @@
+/**
+ * Machine code stencils of the JIT.
+ */
+
+#ifndef VioStencils_h
+#define VioStencils_h
+
+#include <stddef.h>
+
+#include <iterator>
+#include <vector>
+
+#include "../bytecode/OpCode.h"
+#include "../vm/Global.h"
+#include "../vm/VioValue.h"
+#include "X64Assembler.h"
+
+/**
+ * Registers of the VM state while in native code.
+ */
+struct JitState {
+  VioValue* sp;
+  VioValue* bp;
+  VioValue* constants;
+  GlobalVar* globals;
+};
+
+/**
+ * What a hole of a stencil is patched with.
+ */
+enum class HoleKind {
+  /**
+   * operand * scale + addend (disp32 or imm32).
+   */
+  OPERAND,
+
+  /**
+   * rel32 to the code of the jump target instruction.
+   */
+  TARGET,
+
+  /**
+   * rel32 to the exit stub of the instruction.
+   */
+  EXIT,
+
+  /**
+   * Bytecode offset of the instruction (imm32).
+   */
+  OFFSET,
+
+  /**
+   * rel32 to the shared exit sequence.
+   */
+  TAIL,
+};
+
+/**
+ * 32-bit field of a stencil which is patched when it's copied.
+ */
+struct Hole {
+  uint32_t at;
+  HoleKind kind;
+  int32_t scale = 0;
+  int32_t addend = 0;
+};
+
+/**
+ * Relocatable machine code of one instruction.
+ */
+struct Stencil {
+  std::vector<uint8_t> code;
+  std::vector<Hole> holes;
+
+  /**
+   * Whether the stencil jumps to the exit stub of its instruction.
+   */
+  bool exits() const {
+    for (auto& hole : holes) {
+      if (hole.kind == HoleKind::EXIT) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+/**
+ * Library of stencils: one per instruction (and per compare op),
+ * plus the entry, the exit stub and the exit sequence.
+ *
+ * Stencils are assembled once, with zeroed holes. Native code works
+ * on the VM stack in memory through pinned registers (rbx: state,
+ * r12: sp, r13: bp, r14: constants, r15: globals), so it can be
+ * entered and left at any instruction.
+ */
+class VioStencils {
+ public:
+  VioStencils() {
+    entry = assemble([&](X64Assembler& a) {
+      for (auto reg : SAVED) {
+        a.push(reg);
+      }
+      a.mov(RBX, RDI);
+      a.load(R12, RBX, offsetof(JitState, sp));
+      a.load(R13, RBX, offsetof(JitState, bp));
+      a.load(R14, RBX, offsetof(JitState, constants));
+      a.load(R15, RBX, offsetof(JitState, globals));
+      a.jmpReg(RSI);
+    });
+
+    // Exit: eax holds the bytecode offset.
+    tail = assemble([&](X64Assembler& a) {
+      a.store(RBX, offsetof(JitState, sp), R12);
+      for (auto it = std::rbegin(SAVED); it != std::rend(SAVED); ++it) {
+        a.pop(*it);
+      }
+      a.ret();
+    });
+
+    exit = assemble([&](X64Assembler& a) {
+      a.movImm32(RAX, 0);
+      hole(HoleKind::OFFSET);
+      a.jmp(a.newLabel());
+      hole(HoleKind::TAIL);
+    });
+
+    for (auto& stencil : opcodes_) {
+      stencil = exit;
+    }
+
+    opcodes_[OP_CONST] = assemble([&](X64Assembler& a) {
+      pushValue(a, R14, VALUE, 0);
+    });
+    opcodes_[OP_GET_LOCAL] = assemble([&](X64Assembler& a) {
+      pushValue(a, R13, VALUE, 0);
+    });
+    opcodes_[OP_GET_GLOBAL] = assemble([&](X64Assembler& a) {
+      pushValue(a, R15, sizeof(GlobalVar), globalValueOffset());
+    });
+
+    opcodes_[OP_SET_LOCAL] = assemble([&](X64Assembler& a) {
+      a.loadXmm(XMM0, R12, -VALUE);
+      a.storeXmm(R13, 0, XMM0);
+      operandHole(a.offset() - 4, VALUE, 0);
+    });
+    opcodes_[OP_SET_GLOBAL] = assemble([&](X64Assembler& a) {
+      a.loadXmm(XMM0, R12, -VALUE);
+      a.storeXmm(R15, 0, XMM0);
+      operandHole(a.offset() - 4, sizeof(GlobalVar), globalValueOffset());
+    });
+
+    opcodes_[OP_POP] = assemble([&](X64Assembler& a) {
+      a.addImm(R12, -VALUE);
+    });
+
+    // Move the result above the vars
+    opcodes_[OP_SCOPE_EXIT] = assemble([&](X64Assembler& a) {
+      a.loadXmm(XMM0, R12, -VALUE);
+      a.storeXmm(R12, 0, XMM0);
+      operandHole(a.offset() - 4, -VALUE, -VALUE);
+      a.addImm(R12, 0);
+      operandHole(a.offset() - 4, -VALUE, 0);
+    });
+
+    for (auto opcode : {OP_ADD, OP_SUB, OP_MUL, OP_DIV}) {
+      opcodes_[opcode] = assemble([&](X64Assembler& a) {
+        arithmetic(a, opcode);
+      });
+    }
+    opcodes_[OP_ADD_NUM] = opcodes_[OP_ADD];
+    opcodes_[OP_SUB_NUM] = opcodes_[OP_SUB];
+    opcodes_[OP_MUL_NUM] = opcodes_[OP_MUL];
+    opcodes_[OP_DIV_NUM] = opcodes_[OP_DIV];
+
+    for (uint8_t op = 0; op < COMPARE_OPS; op++) {
+      compares_[op] = assemble([&](X64Assembler& a) { compare(a, op); });
+      opcodes_[OP_LT_NUM + op] = compares_[op];
+    }
+
+    opcodes_[OP_JMP] = assemble([&](X64Assembler& a) {
+      a.jmp(a.newLabel());
+      hole(HoleKind::TARGET);
+    });
+    opcodes_[OP_JMP_IF_FALSE] = assemble([&](X64Assembler& a) {
+      a.addImm(R12, -VALUE);
+      a.cmpImm8(R12, PAYLOAD, 0);
+      a.jcc(COND_E, a.newLabel());
+      hole(HoleKind::TARGET);
+    });
+  }
+
+  /**
+   * Stencil of an instruction. Instructions without one (calls,
+   * returns, halt) exit to the interpreter.
+   */
+  const Stencil& of(uint8_t opcode, uint8_t operand) const {
+    if (opcode == OP_COMPARE) {
+      return operand < COMPARE_OPS ? compares_[operand] : exit;
+    }
+    return opcodes_[opcode];
+  }
+
+  /**
+   * Entry: uint32_t (JitState* state, const uint8_t* target)
+   */
+  Stencil entry;
+
+  /**
+   * Shared exit sequence, returns the bytecode offset in eax.
+   */
+  Stencil tail;
+
+  /**
+   * Exit to the interpreter at an instruction.
+   */
+  Stencil exit;
+
+ private:
+  static constexpr int32_t VALUE = sizeof(VioValue);
+  static constexpr int32_t PAYLOAD = offsetof(VioValue, number);
+  static constexpr uint8_t COMPARE_OPS = 6;
+
+  static constexpr Reg SAVED[] = {RBX, RBP, R12, R13, R14, R15};
+
+  /**
+   * Assembles a stencil, `emit` records its holes.
+   */
+  template <typename Emit>
+  Stencil assemble(Emit emit) {
+    X64Assembler a;
+    current_ = Stencil{};
+    assembler_ = &a;
+    emit(a);
+    // binds the jumps inside the stencil, holes stay zero
+    a.finish();
+    current_.code = a.code();
+    assembler_ = nullptr;
+    return current_;
+  }
+
+  /**
+   * The last 4 bytes emitted are a hole.
+   */
+  void hole(HoleKind kind) {
+    current_.holes.push_back(Hole{(uint32_t)assembler_->offset() - 4, kind});
+  }
+
+  void operandHole(size_t at, int32_t scale, int32_t addend) {
+    current_.holes.push_back(
+        Hole{(uint32_t)at, HoleKind::OPERAND, scale, addend});
+  }
+
+  /**
+   * Pushes the value at [base + operand * scale + addend].
+   */
+  void pushValue(X64Assembler& a, Reg base, int32_t scale, int32_t addend) {
+    a.loadXmm(XMM0, base, 0);
+    operandHole(a.offset() - 4, scale, addend);
+    a.storeXmm(R12, 0, XMM0);
+    a.addImm(R12, VALUE);
+  }
+
+  /**
+   * Arithmetic on the two top values: on integers unless it overflows
+   * (or divides with a remainder), otherwise on doubles.
+   */
+  void arithmetic(X64Assembler& a, uint8_t opcode) {
+    auto doubles = a.newLabel();
+    auto done = a.newLabel();
+
+    a.cmpImm32(R12, -2 * VALUE, (int8_t)VioValueType::INTEGER);
+    a.jcc(COND_NE, doubles);
+    a.cmpImm32(R12, -VALUE, (int8_t)VioValueType::INTEGER);
+    a.jcc(COND_NE, doubles);
+    a.load(RAX, R12, -2 * VALUE + PAYLOAD);
+    switch (opcode) {
+      case OP_ADD:
+        a.addMem(RAX, R12, -VALUE + PAYLOAD);
+        a.jcc(COND_O, doubles);
+        break;
+      case OP_SUB:
+        a.subMem(RAX, R12, -VALUE + PAYLOAD);
+        a.jcc(COND_O, doubles);
+        break;
+      case OP_MUL:
+        a.imulMem(RAX, R12, -VALUE + PAYLOAD);
+        a.jcc(COND_O, doubles);
+        break;
+      default: {
+        auto divide = a.newLabel();
+        auto quotient = a.newLabel();
+        a.load(RCX, R12, -VALUE + PAYLOAD);
+        a.test(RCX, RCX);
+        a.jcc(COND_E, doubles);
+        a.cmpImm(RCX, -1);
+        a.jcc(COND_NE, divide);
+        a.neg(RAX);
+        a.jcc(COND_O, doubles);
+        a.jmp(quotient);
+        a.bind(divide);
+        a.idiv(RCX);
+        a.test(RDX, RDX);
+        a.jcc(COND_NE, doubles);
+        a.bind(quotient);
+      }
+    }
+    a.store(R12, -2 * VALUE + PAYLOAD, RAX);
+    a.jmp(done);
+
+    a.bind(doubles);
+    toDouble(a, XMM0, -2 * VALUE, false);
+    toDouble(a, XMM1, -VALUE, false);
+    switch (opcode) {
+      case OP_ADD:
+        a.addSd(XMM0, XMM1);
+        break;
+      case OP_SUB:
+        a.subSd(XMM0, XMM1);
+        break;
+      case OP_MUL:
+        a.mulSd(XMM0, XMM1);
+        break;
+      default:
+        a.divSd(XMM0, XMM1);
+    }
+    a.storeSd(R12, -2 * VALUE + PAYLOAD, XMM0);
+    a.storeImm32(R12, -2 * VALUE, (int32_t)VioValueType::NUMBER);
+
+    a.bind(done);
+    a.addImm(R12, -VALUE);
+  }
+
+  /**
+   * Comparison (compare op as in OP_COMPARE) of the two top values:
+   * signed on integers, otherwise on doubles, where unordered (NaN)
+   * operands compare false, except for !=.
+   */
+  void compare(X64Assembler& a, uint8_t op) {
+    static const Cond integerConds[] = {COND_L,  COND_G,  COND_E,
+                                        COND_GE, COND_LE, COND_NE};
+    auto doubles = a.newLabel();
+    auto result = a.newLabel();
+
+    a.cmpImm32(R12, -2 * VALUE, (int8_t)VioValueType::INTEGER);
+    a.jcc(COND_NE, doubles);
+    a.cmpImm32(R12, -VALUE, (int8_t)VioValueType::INTEGER);
+    a.jcc(COND_NE, doubles);
+    a.load(RAX, R12, -2 * VALUE + PAYLOAD);
+    a.cmpMem(RAX, R12, -VALUE + PAYLOAD);
+    a.setcc(integerConds[op], RAX);
+    a.jmp(result);
+
+    a.bind(doubles);
+    toDouble(a, XMM0, -2 * VALUE, true);
+    toDouble(a, XMM1, -VALUE, true);
+    switch (op) {
+      case 0:  // <
+        a.ucomisd(XMM1, XMM0);
+        a.setcc(COND_A, RAX);
+        break;
+      case 1:  // >
+        a.ucomisd(XMM0, XMM1);
+        a.setcc(COND_A, RAX);
+        break;
+      case 2:  // ==
+        a.ucomisd(XMM0, XMM1);
+        a.setcc(COND_E, RAX);
+        a.setcc(COND_NP, RCX);
+        a.andByte(RAX, RCX);
+        break;
+      case 3:  // >=
+        a.ucomisd(XMM0, XMM1);
+        a.setcc(COND_AE, RAX);
+        break;
+      case 4:  // <=
+        a.ucomisd(XMM1, XMM0);
+        a.setcc(COND_AE, RAX);
+        break;
+      case 5:  // !=
+        a.ucomisd(XMM0, XMM1);
+        a.setcc(COND_NE, RAX);
+        a.setcc(COND_P, RCX);
+        a.orByte(RAX, RCX);
+        break;
+    }
+
+    a.bind(result);
+    a.storeImm32(R12, -2 * VALUE, (int32_t)VioValueType::BOOLEAN);
+    a.storeImm64(R12, -2 * VALUE + PAYLOAD, 0);
+    a.storeByte(R12, -2 * VALUE + PAYLOAD, RAX);
+    a.addImm(R12, -VALUE);
+  }
+
+  /**
+   * Loads the number or integer at [sp + disp] as a double, exits to
+   * the interpreter on other values. With `exact`, also on integers
+   * which don't convert exactly (beyond 2^53), so that comparisons
+   * with doubles stay exact.
+   */
+  void toDouble(X64Assembler& a, XmmReg reg, int32_t disp, bool exact) {
+    auto number = a.newLabel();
+    auto done = a.newLabel();
+    a.cmpImm32(R12, disp, (int8_t)VioValueType::INTEGER);
+    a.jcc(COND_NE, number);
+    if (exact) {
+      a.load(RAX, R12, disp + PAYLOAD);
+      a.mov(RCX, RAX);
+      a.sarImm(RCX, 53);
+      a.addImm(RCX, 1);
+      a.cmpImm(RCX, 1);
+      a.jcc(COND_A, a.newLabel());
+      hole(HoleKind::EXIT);
+      a.cvtInt(reg, RAX);
+    } else {
+      a.cvtInt(reg, R12, disp + PAYLOAD);
+    }
+    a.jmp(done);
+
+    a.bind(number);
+    a.cmpImm32(R12, disp, (int8_t)VioValueType::NUMBER);
+    a.jcc(COND_NE, a.newLabel());
+    hole(HoleKind::EXIT);
+    a.loadSd(reg, R12, disp + PAYLOAD);
+    a.bind(done);
+  }
+
+  /**
+   * Offset of the value in a global var.
+   */
+  static int32_t globalValueOffset() {
+    GlobalVar var;
+    return (char*)&var.value - (char*)&var;
+  }
+
+  Stencil opcodes_[256];
+  Stencil compares_[COMPARE_OPS];
+
+  /**
+   * Stencil being assembled.
+   */
+  Stencil current_;
+  X64Assembler* assembler_ = nullptr;
+};
+
+#endif
@@ -0,0 +1,501 @@
+/**
+ * Minimal x86-64 assembler.
+ */
+
+#ifndef X64Assembler_h
+#define X64Assembler_h
+
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * General purpose registers (numbered as in the encoding).
+ */
+enum Reg : uint8_t {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+};
+
+/**
+ * SSE registers.
+ */
+enum XmmReg : uint8_t {
+  XMM0 = 0,
+  XMM1 = 1,
+};
+
+/**
+ * Condition codes of jcc/setcc.
+ */
+enum Cond : uint8_t {
+  COND_O = 0x0,
+  COND_B = 0x2,
+  COND_AE = 0x3,
+  COND_E = 0x4,
+  COND_NE = 0x5,
+  COND_A = 0x7,
+  COND_P = 0xA,
+  COND_NP = 0xB,
+  COND_L = 0xC,
+  COND_GE = 0xD,
+  COND_LE = 0xE,
+  COND_G = 0xF,
+};
+
+/**
+ * Emits x86-64 machine code into a byte buffer: just the instructions
+ * the baseline JIT needs. Memory operands are always [base + disp32].
+ *
+ * Jumps refer to labels, patched when the label is bound (`bind`)
+ * or at the end (`finish`).
+ */
+class X64Assembler {
+ public:
+  using Label = int;
+
+  const std::vector<uint8_t>& code() const { return code_; }
+
+  size_t offset() const { return code_.size(); }
+
+  // -----------------------------------------------------------------
+  // Labels
+
+  Label newLabel() {
+    labels_.push_back(-1);
+    return labels_.size() - 1;
+  }
+
+  void bind(Label label) { labels_[label] = code_.size(); }
+
+  /**
+   * Patches jumps to their labels, returns false if some
+   * label is not bound (its jumps are left as they are).
+   */
+  bool finish() {
+    bool bound = true;
+    for (auto& [at, label] : fixups_) {
+      if (labels_[label] == -1) {
+        bound = false;
+        continue;
+      }
+      int32_t rel = labels_[label] - (int64_t)(at + 4);
+      for (int i = 0; i < 4; i++) {
+        code_[at + i] = (rel >> (8 * i)) & 0xff;
+      }
+    }
+    fixups_.clear();
+    return bound;
+  }
+
+  // -----------------------------------------------------------------
+  // Moves
+
+  /**
+   * mov dst, src
+   */
+  void mov(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x89);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  /**
+   * mov reg, [base + disp]
+   */
+  void load(Reg reg, Reg base, int32_t disp) {
+    rex(true, reg, base);
+    byte(0x8B);
+    mem(reg, base, disp);
+  }
+
+  /**
+   * mov [base + disp], reg
+   */
+  void store(Reg base, int32_t disp, Reg reg) {
+    rex(true, reg, base);
+    byte(0x89);
+    mem(reg, base, disp);
+  }
+
+  /**
+   * mov byte [base + disp], reg8 (al, cl, dl, bl)
+   */
+  void storeByte(Reg base, int32_t disp, Reg reg) {
+    rex(false, reg, base);
+    byte(0x88);
+    mem(reg, base, disp);
+  }
+
+  /**
+   * mov dword [base + disp], imm32
+   */
+  void storeImm32(Reg base, int32_t disp, int32_t imm) {
+    rex(false, RAX, base);
+    byte(0xC7);
+    mem(RAX, base, disp);
+    dword(imm);
+  }
+
+  /**
+   * mov qword [base + disp], imm32 (sign-extended)
+   */
+  void storeImm64(Reg base, int32_t disp, int32_t imm) {
+    rex(true, RAX, base);
+    byte(0xC7);
+    mem(RAX, base, disp);
+    dword(imm);
+  }
+
+  /**
+   * mov reg32, imm32
+   */
+  void movImm32(Reg reg, uint32_t imm) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0xB8 + (reg & 7));
+    dword(imm);
+  }
+
+  /**
+   * movzx reg32, reg8
+   */
+  void movzxByte(Reg dst, Reg src) {
+    byte(0x0F);
+    byte(0xB6);
+    byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+  }
+
+  // -----------------------------------------------------------------
+  // Integer arithmetic
+
+  /**
+   * add reg, imm32
+   */
+  void addImm(Reg reg, int32_t imm) {
+    rex(true, RAX, reg);
+    byte(0x81);
+    byte(0xC0 | (reg & 7));
+    dword(imm);
+  }
+
+  /**
+   * add/sub/imul/cmp reg, qword [base + disp]
+   */
+  void addMem(Reg reg, Reg base, int32_t disp) { alu(0x03, reg, base, disp); }
+  void subMem(Reg reg, Reg base, int32_t disp) { alu(0x2B, reg, base, disp); }
+  void cmpMem(Reg reg, Reg base, int32_t disp) { alu(0x3B, reg, base, disp); }
+
+  void imulMem(Reg reg, Reg base, int32_t disp) {
+    rex(true, reg, base);
+    byte(0x0F);
+    byte(0xAF);
+    mem(reg, base, disp);
+  }
+
+  /**
+   * cmp reg, imm32
+   */
+  void cmpImm(Reg reg, int32_t imm) {
+    rex(true, RAX, reg);
+    byte(0x81);
+    byte(0xF8 | (reg & 7));
+    dword(imm);
+  }
+
+  /**
+   * sar reg, imm8
+   */
+  void sarImm(Reg reg, uint8_t imm) {
+    rex(true, RAX, reg);
+    byte(0xC1);
+    byte(0xF8 | (reg & 7));
+    byte(imm);
+  }
+
+  /**
+   * neg reg
+   */
+  void neg(Reg reg) {
+    rex(true, RAX, reg);
+    byte(0xF7);
+    byte(0xD8 | (reg & 7));
+  }
+
+  /**
+   * test a, b
+   */
+  void test(Reg a, Reg b) {
+    rex(true, b, a);
+    byte(0x85);
+    byte(0xC0 | ((b & 7) << 3) | (a & 7));
+  }
+
+  /**
+   * cqo; idiv reg: rdx:rax / reg, quotient in rax, remainder in rdx.
+   */
+  void idiv(Reg reg) {
+    byte(0x48);
+    byte(0x99);
+    rex(true, RAX, reg);
+    byte(0xF7);
+    byte(0xF8 | (reg & 7));
+  }
+
+  /**
+   * cmp dword [base + disp], imm8
+   */
+  void cmpImm32(Reg base, int32_t disp, int8_t imm) {
+    rex(false, RDI, base);
+    byte(0x83);
+    mem(RDI, base, disp);  // /7
+    byte(imm);
+  }
+
+  /**
+   * cmp byte [base + disp], imm8
+   */
+  void cmpImm8(Reg base, int32_t disp, int8_t imm) {
+    rex(false, RDI, base);
+    byte(0x80);
+    mem(RDI, base, disp);  // /7
+    byte(imm);
+  }
+
+  /**
+   * and / or of 8-bit registers: dst op= src
+   */
+  void andByte(Reg dst, Reg src) {
+    byte(0x20);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  void orByte(Reg dst, Reg src) {
+    byte(0x08);
+    byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+  }
+
+  /**
+   * setcc reg8
+   */
+  void setcc(Cond cond, Reg reg) {
+    byte(0x0F);
+    byte(0x90 | cond);
+    byte(0xC0 | (reg & 7));
+  }
+
+  // -----------------------------------------------------------------
+  // SSE
+
+  /**
+   * movups xmm, [base + disp] (16-byte copies of values)
+   */
+  void loadXmm(XmmReg reg, Reg base, int32_t disp) {
+    rex(false, (Reg)reg, base);
+    byte(0x0F);
+    byte(0x10);
+    mem((Reg)reg, base, disp);
+  }
+
+  /**
+   * movups [base + disp], xmm
+   */
+  void storeXmm(Reg base, int32_t disp, XmmReg reg) {
+    rex(false, (Reg)reg, base);
+    byte(0x0F);
+    byte(0x11);
+    mem((Reg)reg, base, disp);
+  }
+
+  /**
+   * movsd xmm, [base + disp]
+   */
+  void loadSd(XmmReg reg, Reg base, int32_t disp) { sse(0x10, reg, base, disp); }
+
+  /**
+   * movsd [base + disp], xmm
+   */
+  void storeSd(Reg base, int32_t disp, XmmReg reg) {
+    sse(0x11, reg, base, disp);
+  }
+
+  /**
+   * addsd/subsd/mulsd/divsd xmm, [base + disp]
+   */
+  void addSd(XmmReg reg, Reg base, int32_t disp) { sse(0x58, reg, base, disp); }
+  void subSd(XmmReg reg, Reg base, int32_t disp) { sse(0x5C, reg, base, disp); }
+  void mulSd(XmmReg reg, Reg base, int32_t disp) { sse(0x59, reg, base, disp); }
+  void divSd(XmmReg reg, Reg base, int32_t disp) { sse(0x5E, reg, base, disp); }
+
+  /**
+   * addsd/subsd/mulsd/divsd dst, src
+   */
+  void addSd(XmmReg dst, XmmReg src) { sseReg(0x58, dst, src); }
+  void subSd(XmmReg dst, XmmReg src) { sseReg(0x5C, dst, src); }
+  void mulSd(XmmReg dst, XmmReg src) { sseReg(0x59, dst, src); }
+  void divSd(XmmReg dst, XmmReg src) { sseReg(0x5E, dst, src); }
+
+  /**
+   * cvtsi2sd xmm, qword [base + disp]
+   */
+  void cvtInt(XmmReg reg, Reg base, int32_t disp) {
+    byte(0xF2);
+    rex(true, (Reg)reg, base);
+    byte(0x0F);
+    byte(0x2A);
+    mem((Reg)reg, base, disp);
+  }
+
+  /**
+   * cvtsi2sd xmm, reg
+   */
+  void cvtInt(XmmReg dst, Reg src) {
+    byte(0xF2);
+    rex(true, RAX, src);
+    byte(0x0F);
+    byte(0x2A);
+    byte(0xC0 | (dst << 3) | (src & 7));
+  }
+
+  /**
+   * ucomisd a, b
+   */
+  void ucomisd(XmmReg a, XmmReg b) {
+    byte(0x66);
+    byte(0x0F);
+    byte(0x2E);
+    byte(0xC0 | (a << 3) | b);
+  }
+
+  // -----------------------------------------------------------------
+  // Control flow
+
+  void jmp(Label label) {
+    byte(0xE9);
+    fixup(label);
+  }
+
+  void jcc(Cond cond, Label label) {
+    byte(0x0F);
+    byte(0x80 | cond);
+    fixup(label);
+  }
+
+  /**
+   * jmp reg
+   */
+  void jmpReg(Reg reg) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0xFF);
+    byte(0xE0 | (reg & 7));
+  }
+
+  void push(Reg reg) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0x50 + (reg & 7));
+  }
+
+  void pop(Reg reg) {
+    if (reg >= 8) {
+      byte(0x41);
+    }
+    byte(0x58 + (reg & 7));
+  }
+
+  void ret() { byte(0xC3); }
+
+ private:
+  void byte(uint8_t value) { code_.push_back(value); }
+
+  void dword(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      byte((value >> (8 * i)) & 0xff);
+    }
+  }
+
+  /**
+   * REX prefix, omitted if not needed.
+   */
+  void rex(bool wide, Reg reg, Reg base) {
+    uint8_t prefix = 0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) |
+                     (base >= 8 ? 1 : 0);
+    if (prefix != 0x40) {
+      byte(prefix);
+    }
+  }
+
+  /**
+   * ModRM (and SIB) of [base + disp32].
+   */
+  void mem(Reg reg, Reg base, int32_t disp) {
+    byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+      byte(0x24);
+    }
+    dword(disp);
+  }
+
+  /**
+   * Integer instruction: REX.W <opcode> reg, [base + disp].
+   */
+  void alu(uint8_t opcode, Reg reg, Reg base, int32_t disp) {
+    rex(true, reg, base);
+    byte(opcode);
+    mem(reg, base, disp);
+  }
+
+  /**
+   * Scalar double instruction: F2 0F <opcode> dst, src.
+   */
+  void sseReg(uint8_t opcode, XmmReg dst, XmmReg src) {
+    byte(0xF2);
+    byte(0x0F);
+    byte(opcode);
+    byte(0xC0 | (dst << 3) | src);
+  }
+
+  /**
+   * Scalar double instruction: F2 0F <opcode> with a memory operand.
+   */
+  void sse(uint8_t opcode, XmmReg reg, Reg base, int32_t disp) {
+    byte(0xF2);
+    rex(false, (Reg)reg, base);
+    byte(0x0F);
+    byte(opcode);
+    mem((Reg)reg, base, disp);
+  }
+
+  void fixup(Label label) {
+    fixups_.push_back({code_.size(), label});
+    dword(0);
+  }
+
+  std::vector<uint8_t> code_;
+
+  /**
+   * Code offset of each label, -1 if not bound yet.
+   */
+  std::vector<int64_t> labels_;
+
+  /**
+   * Positions of rel32 jump operands and their labels.
+   */
+  std::vector<std::pair<size_t, Label>> fixups_;
+};
+
+#endif
@@ -50,6 +50,7 @@
 //   }
 //
 // clang-format off
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -69,12 +70,12 @@ enum class ExpType {
 struct Exp {
   ExpType type;
 
-  int number;
+  int64_t number;
   std::string string;
   std::vector<Exp> list;
 
   // Numbers:
-  Exp(int number) : type(ExpType::NUMBER), number(number) {}
+  Exp(int64_t number) : type(ExpType::NUMBER), number(number) {}
 
   // Strings, Symbols:
   Exp(std::string& strVal) {
@@ -703,7 +704,7 @@ void _handler4(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_T();
 
-auto __ = Exp(std::stoi(_1)) ;
+auto __ = Exp(std::stoll(_1)) ;
 
  // Semantic action epilogue.
 PUSH_VR();
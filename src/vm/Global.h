@@ -5,6 +5,11 @@
 #ifndef Global_h
 #define Global_h
 
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 /**
  * Global var.
  */
@@ -39,11 +44,11 @@ struct Global {
   /**
    * Adds a global constant.
    */
-  void addGlobal(const std::string& name, double value) {
+  void addGlobal(const std::string& name, int64_t value) {
     if (exists(name)) {
       return;
     }
-    globals.push_back({name, NUMBER(value)});
+    add({name, INTEGER(value)});
     // (GlobalVar)
   }
 
@@ -51,15 +56,8 @@ struct Global {
    * Get global index.
    */
   int getGlobalIndex(const std::string& name) {
-    if (globals.size() > 0) {
-      for (auto i = (int)globals.size() - 1; i >= 0; i --)
-      {
-        if (globals[i].name == name) {
-          return i;
-        }
-      }
-    }
-    return -1;
+    auto it = indexByName.find(name);
+    return it == indexByName.end() ? -1 : it->second;
   }
 
   /**
@@ -78,7 +76,7 @@ struct Global {
     }
 
     // Set to default number
-    globals.push_back((GlobalVar){name, NUMBER(0)});
+    add((GlobalVar){name, INTEGER(0)});
   }
 
     /**
@@ -90,7 +88,21 @@ struct Global {
       return;
     }
     // (GlobalVar)
-    globals.push_back({name, ALLOC_NATIVE(fn, name, arity)});
+    add({name, ALLOC_NATIVE(fn, name, arity)});
+  }
+
+  /**
+   * Global indices by name.
+   */
+  std::unordered_map<std::string, int> indexByName;
+
+ private:
+  /**
+   * Appends a new global and indexes it by name.
+   */
+  void add(const GlobalVar& var) {
+    indexByName[var.name] = globals.size();
+    globals.push_back(var);
   }
 
 };
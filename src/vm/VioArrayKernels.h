@@ -0,0 +1,454 @@
+/**
+ * Bulk kernels of Float64 arrays.
+ */
+
+#ifndef VioArrayKernels_h
+#define VioArrayKernels_h
+
+#include <stddef.h>
+
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Bulk operations on contiguous doubles, one table per instruction
+ * set. The VM uses the best one the CPU supports (`best`), picked
+ * once at the first use.
+ *
+ * Vector kernels sum in several lanes, so `sum` and `dot` may round
+ * differently from a sequential loop.
+ */
+struct ArrayKernels {
+  const char* name;
+
+  double (*sum)(const double* a, size_t n);
+  double (*dot)(const double* a, const double* b, size_t n);
+
+  /**
+   * out[i] = a[i] * k
+   */
+  void (*scale)(const double* a, double k, double* out, size_t n);
+
+  /**
+   * out[i] = a[i] + b[i]
+   */
+  void (*add)(const double* a, const double* b, double* out, size_t n);
+
+  /**
+   * Smallest and largest of `n` > 0 values.
+   */
+  double (*min)(const double* a, size_t n);
+  double (*max)(const double* a, size_t n);
+
+  /**
+   * Copies the values greater than `x` to `out` (with room for
+   * n + 4 values), in order, returns their count.
+   */
+  size_t (*filterGt)(const double* a, size_t n, double x, double* out);
+
+  static const ArrayKernels& scalar();
+  static const ArrayKernels* sse2();
+  static const ArrayKernels* avx2();
+
+  /**
+   * Kernels supported by the CPU, scalar first.
+   */
+  static std::vector<const ArrayKernels*> supported() {
+    std::vector<const ArrayKernels*> kernels{&scalar()};
+    for (auto simd : {sse2(), avx2()}) {
+      if (simd != nullptr) {
+        kernels.push_back(simd);
+      }
+    }
+    return kernels;
+  }
+
+  /**
+   * Fastest kernels supported by the CPU.
+   */
+  static const ArrayKernels& best() {
+    static const ArrayKernels* kernels = supported().back();
+    return *kernels;
+  }
+};
+
+// --------------------------------------------------
+// Scalar kernels.
+
+inline double scalarSum(const double* a, size_t n) {
+  double s = 0;
+  for (size_t i = 0; i < n; i++) {
+    s += a[i];
+  }
+  return s;
+}
+
+inline double scalarDot(const double* a, const double* b, size_t n) {
+  double s = 0;
+  for (size_t i = 0; i < n; i++) {
+    s += a[i] * b[i];
+  }
+  return s;
+}
+
+inline void scalarScale(const double* a, double k, double* out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = a[i] * k;
+  }
+}
+
+inline void scalarAdd(const double* a, const double* b, double* out,
+                      size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+inline double scalarMin(const double* a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; i++) {
+    m = a[i] < m ? a[i] : m;
+  }
+  return m;
+}
+
+inline double scalarMax(const double* a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; i++) {
+    m = a[i] > m ? a[i] : m;
+  }
+  return m;
+}
+
+inline size_t scalarFilterGt(const double* a, size_t n, double x,
+                             double* out) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (a[i] > x) {
+      out[count++] = a[i];
+    }
+  }
+  return count;
+}
+
+inline const ArrayKernels& ArrayKernels::scalar() {
+  static const ArrayKernels kernels{
+      "scalar",  scalarSum, scalarDot,     scalarScale,
+      scalarAdd, scalarMin, scalarMax, scalarFilterGt};
+  return kernels;
+}
+
+#if defined(__x86_64__)
+
+// --------------------------------------------------
+// SSE2 kernels (2 lanes), baseline of x86-64.
+
+inline double sse2Sum(const double* a, size_t n) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+  }
+  s0 = _mm_add_pd(s0, s1);
+  double s = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+  for (; i < n; i++) {
+    s += a[i];
+  }
+  return s;
+}
+
+inline double sse2Dot(const double* a, const double* b, size_t n) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    s1 = _mm_add_pd(
+        s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+  }
+  s0 = _mm_add_pd(s0, s1);
+  double s = _mm_cvtsd_f64(_mm_add_sd(s0, _mm_unpackhi_pd(s0, s0)));
+  for (; i < n; i++) {
+    s += a[i] * b[i];
+  }
+  return s;
+}
+
+inline void sse2Scale(const double* a, double k, double* out, size_t n) {
+  __m128d factor = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] * k;
+  }
+}
+
+inline void sse2Add(const double* a, const double* b, double* out, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(out + i,
+                  _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+inline double sse2Min(const double* a, size_t n) {
+  if (n < 2) {
+    return scalarMin(a, n);
+  }
+  __m128d m = _mm_loadu_pd(a);
+  size_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    m = _mm_min_pd(_mm_loadu_pd(a + i), m);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, m);
+  double result = lanes[1] < lanes[0] ? lanes[1] : lanes[0];
+  for (; i < n; i++) {
+    result = a[i] < result ? a[i] : result;
+  }
+  return result;
+}
+
+inline double sse2Max(const double* a, size_t n) {
+  if (n < 2) {
+    return scalarMax(a, n);
+  }
+  __m128d m = _mm_loadu_pd(a);
+  size_t i = 2;
+  for (; i + 2 <= n; i += 2) {
+    m = _mm_max_pd(_mm_loadu_pd(a + i), m);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, m);
+  double result = lanes[1] > lanes[0] ? lanes[1] : lanes[0];
+  for (; i < n; i++) {
+    result = a[i] > result ? a[i] : result;
+  }
+  return result;
+}
+
+inline size_t sse2FilterGt(const double* a, size_t n, double x, double* out) {
+  __m128d bound = _mm_set1_pd(x);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(a + i);
+    switch (_mm_movemask_pd(_mm_cmpgt_pd(v, bound))) {
+      case 1:
+        _mm_storel_pd(out + count, v);
+        count += 1;
+        break;
+      case 2:
+        _mm_storeh_pd(out + count, v);
+        count += 1;
+        break;
+      case 3:
+        _mm_storeu_pd(out + count, v);
+        count += 2;
+        break;
+    }
+  }
+  return count + scalarFilterGt(a + i, n - i, x, out + count);
+}
+
+inline const ArrayKernels* ArrayKernels::sse2() {
+  static const ArrayKernels kernels{"sse2",  sse2Sum, sse2Dot, sse2Scale,
+                                    sse2Add, sse2Min, sse2Max, sse2FilterGt};
+  return &kernels;
+}
+
+// --------------------------------------------------
+// AVX2 kernels (4 lanes), compiled for AVX2 only, called when the CPU
+// supports it.
+
+#define AVX2_KERNEL __attribute__((target("avx2")))
+
+AVX2_KERNEL inline double avx2Horizontal(__m256d v) {
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v),
+                         _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+AVX2_KERNEL inline double avx2Sum(const double* a, size_t n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  __m256d s2 = _mm256_setzero_pd();
+  __m256d s3 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+    s2 = _mm256_add_pd(s2, _mm256_loadu_pd(a + i + 8));
+    s3 = _mm256_add_pd(s3, _mm256_loadu_pd(a + i + 12));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+  }
+  double s = avx2Horizontal(
+      _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+  for (; i < n; i++) {
+    s += a[i];
+  }
+  return s;
+}
+
+AVX2_KERNEL inline double avx2Dot(const double* a, const double* b,
+                                  size_t n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  __m256d s2 = _mm256_setzero_pd();
+  __m256d s3 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                         _mm256_loadu_pd(b + i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                         _mm256_loadu_pd(b + i + 4)));
+    s2 = _mm256_add_pd(s2, _mm256_mul_pd(_mm256_loadu_pd(a + i + 8),
+                                         _mm256_loadu_pd(b + i + 8)));
+    s3 = _mm256_add_pd(s3, _mm256_mul_pd(_mm256_loadu_pd(a + i + 12),
+                                         _mm256_loadu_pd(b + i + 12)));
+  }
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                         _mm256_loadu_pd(b + i)));
+  }
+  double s = avx2Horizontal(
+      _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+  for (; i < n; i++) {
+    s += a[i] * b[i];
+  }
+  return s;
+}
+
+AVX2_KERNEL inline void avx2Scale(const double* a, double k, double* out,
+                                  size_t n) {
+  __m256d factor = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] * k;
+  }
+}
+
+AVX2_KERNEL inline void avx2Add(const double* a, const double* b, double* out,
+                                size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(
+        out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  for (; i < n; i++) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+AVX2_KERNEL inline double avx2Min(const double* a, size_t n) {
+  if (n < 4) {
+    return scalarMin(a, n);
+  }
+  __m256d m = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(_mm256_loadu_pd(a + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = scalarMin(lanes, 4);
+  for (; i < n; i++) {
+    result = a[i] < result ? a[i] : result;
+  }
+  return result;
+}
+
+AVX2_KERNEL inline double avx2Max(const double* a, size_t n) {
+  if (n < 4) {
+    return scalarMax(a, n);
+  }
+  __m256d m = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(_mm256_loadu_pd(a + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double result = scalarMax(lanes, 4);
+  for (; i < n; i++) {
+    result = a[i] > result ? a[i] : result;
+  }
+  return result;
+}
+
+/**
+ * Permutations (of 32-bit halves) moving the lanes selected by a
+ * 4-bit mask to the front, in order.
+ */
+struct Avx2Compaction {
+  Avx2Compaction() {
+    for (int mask = 0; mask < 16; mask++) {
+      int at = 0;
+      for (int lane = 0; lane < 4; lane++) {
+        if (mask & (1 << lane)) {
+          indices[mask][at++] = 2 * lane;
+          indices[mask][at++] = 2 * lane + 1;
+        }
+      }
+      for (; at < 8; at++) {
+        indices[mask][at] = 0;
+      }
+    }
+  }
+
+  alignas(32) int32_t indices[16][8];
+};
+
+AVX2_KERNEL inline size_t avx2FilterGt(const double* a, size_t n, double x,
+                                       double* out) {
+  static const Avx2Compaction compaction;
+  __m256d bound = _mm256_set1_pd(x);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(a + i);
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(v, bound, _CMP_GT_OQ));
+    __m256i permutation =
+        _mm256_load_si256((const __m256i*)compaction.indices[mask]);
+    // writes 4 values, the selected ones first
+    _mm256_storeu_pd(out + count, _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(
+                                      _mm256_castpd_si256(v), permutation)));
+    count += __builtin_popcount(mask);
+  }
+  return count + scalarFilterGt(a + i, n - i, x, out + count);
+}
+
+#undef AVX2_KERNEL
+
+inline const ArrayKernels* ArrayKernels::avx2() {
+  if (!__builtin_cpu_supports("avx2")) {
+    return nullptr;
+  }
+  static const ArrayKernels kernels{"avx2",  avx2Sum, avx2Dot, avx2Scale,
+                                    avx2Add, avx2Min, avx2Max, avx2FilterGt};
+  return &kernels;
+}
+
+#else
+
+inline const ArrayKernels* ArrayKernels::sse2() { return nullptr; }
+inline const ArrayKernels* ArrayKernels::avx2() { return nullptr; }
+
+#endif
+
+#endif
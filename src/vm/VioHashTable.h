@@ -0,0 +1,252 @@
+/**
+ * Open-addressing hash table.
+ */
+
+#ifndef VioHashTable_h
+#define VioHashTable_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Control byte of a slot: EMPTY, DELETED (tombstone), or the low 7 bits
+ * of the hash of its key when full.
+ */
+enum : int8_t {
+  CTRL_EMPTY = -128,
+  CTRL_DELETED = -2,
+};
+
+/**
+ * Swiss-table style hash map: slots are in groups of 16, with one
+ * control byte per slot stored apart from the slots. A lookup probes
+ * groups: it compares the 16 control bytes of a group to the 7-bit
+ * hash tag at once, and only reads the slots whose tag matches, so it
+ * typically touches one line of control bytes and one slot. Probing
+ * stops at a group with an empty slot.
+ *
+ * `Hash` returns a well mixed 64-bit hash: its low 7 bits are the tag,
+ * the rest picks the first group.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+class VioHashTable {
+ public:
+  /**
+   * Entry of a full slot.
+   */
+  struct Slot {
+    Key key;
+    Value value;
+  };
+
+  /**
+   * Value of the key, nullptr if it isn't in the table.
+   */
+  Value* find(const Key& key) {
+    auto index = indexOf(key, Hash()(key));
+    return index == SIZE_MAX ? nullptr : &slots_[index].value;
+  }
+
+  /**
+   * Sets the value of the key, inserting it if it's new.
+   */
+  void set(const Key& key, const Value& value) {
+    auto hash = Hash()(key);
+    auto index = indexOf(key, hash);
+    if (index != SIZE_MAX) {
+      slots_[index].value = value;
+      return;
+    }
+    if ((size_ + deleted_ + 1) * 8 > capacity() * 7) {
+      // grow, or just drop the tombstones if they take the room
+      rehash(size_ * 2 + 2 > capacity() ? capacity() * 2 : capacity());
+    }
+    index = freeSlot(hash);
+    deleted_ -= ctrl_[index] == CTRL_DELETED;
+    ctrl_[index] = tag(hash);
+    slots_[index] = Slot{key, value};
+    size_++;
+  }
+
+  /**
+   * Removes the key, returns whether it was in the table.
+   */
+  bool erase(const Key& key) {
+    auto index = indexOf(key, Hash()(key));
+    if (index == SIZE_MAX) {
+      return false;
+    }
+    // No probe went past a group with an empty slot, so the slot can
+    // be emptied there. Elsewhere it stays on probe sequences.
+    if (match(index / GROUP_SIZE * GROUP_SIZE, CTRL_EMPTY) != 0) {
+      ctrl_[index] = CTRL_EMPTY;
+    } else {
+      ctrl_[index] = CTRL_DELETED;
+      deleted_++;
+    }
+    size_--;
+    return true;
+  }
+
+  /**
+   * Calls fn(key, value) for each entry, in slot order.
+   */
+  template <typename Fn>
+  void forEach(Fn fn) {
+    for (size_t i = 0; i < ctrl_.size(); i++) {
+      if (ctrl_[i] >= 0) {
+        fn(slots_[i].key, slots_[i].value);
+      }
+    }
+  }
+
+  /**
+   * Number of entries.
+   */
+  size_t size() const { return size_; }
+
+  /**
+   * Number of slots.
+   */
+  size_t capacity() const { return ctrl_.size(); }
+
+ private:
+  static constexpr size_t GROUP_SIZE = 16;
+
+  static int8_t tag(uint64_t hash) { return hash & 0x7F; }
+
+  /**
+   * Bit i set for each control byte i of the group at `group` (a slot
+   * index) equal to `ctrl`.
+   */
+  uint32_t match(size_t group, int8_t ctrl) const {
+#if defined(__SSE2__)
+    auto bytes = _mm_loadu_si128((const __m128i*)(ctrl_.data() + group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; i++) {
+      mask |= (uint32_t)(ctrl_[group + i] == ctrl) << i;
+    }
+    return mask;
+#endif
+  }
+
+  /**
+   * Bit i set for each empty or deleted slot i of the group.
+   */
+  uint32_t matchFree(size_t group) const {
+#if defined(__SSE2__)
+    auto bytes = _mm_loadu_si128((const __m128i*)(ctrl_.data() + group));
+    return _mm_movemask_epi8(_mm_cmplt_epi8(bytes, _mm_set1_epi8(-1)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP_SIZE; i++) {
+      mask |= (uint32_t)(ctrl_[group + i] < -1) << i;
+    }
+    return mask;
+#endif
+  }
+
+  /**
+   * Calls fn(group) on the probe sequence of the hash until it returns
+   * true: quadratic (triangular) steps over the groups, which visit
+   * each group once.
+   */
+  template <typename Fn>
+  void probe(uint64_t hash, Fn fn) const {
+    size_t groups = capacity() / GROUP_SIZE;
+    size_t group = (hash >> 7) & (groups - 1);
+    for (size_t step = 1; step <= groups; step++) {
+      if (fn(group * GROUP_SIZE)) {
+        return;
+      }
+      group = (group + step) & (groups - 1);
+    }
+  }
+
+  /**
+   * Slot index of the key, SIZE_MAX if it isn't in the table.
+   */
+  size_t indexOf(const Key& key, uint64_t hash) const {
+    size_t found = SIZE_MAX;
+    if (size_ == 0) {
+      return found;
+    }
+    probe(hash, [&](size_t group) {
+      for (auto mask = match(group, tag(hash)); mask != 0; mask &= mask - 1) {
+        auto index = group + __builtin_ctz(mask);
+        if (Equal()(slots_[index].key, key)) {
+          found = index;
+          return true;
+        }
+      }
+      return match(group, CTRL_EMPTY) != 0;
+    });
+    return found;
+  }
+
+  /**
+   * First empty or deleted slot on the probe sequence of the hash.
+   */
+  size_t freeSlot(uint64_t hash) const {
+    size_t index = SIZE_MAX;
+    probe(hash, [&](size_t group) {
+      auto mask = matchFree(group);
+      if (mask == 0) {
+        return false;
+      }
+      index = group + __builtin_ctz(mask);
+      return true;
+    });
+    return index;
+  }
+
+  /**
+   * Reinserts the entries into `capacity` slots (a power of two, at
+   * least a group), dropping the tombstones.
+   */
+  void rehash(size_t capacity) {
+    if (capacity < GROUP_SIZE) {
+      capacity = GROUP_SIZE;
+    }
+    auto ctrl = std::move(ctrl_);
+    auto slots = std::move(slots_);
+    ctrl_.assign(capacity, CTRL_EMPTY);
+    slots_.assign(capacity, Slot{});
+    deleted_ = 0;
+    for (size_t i = 0; i < ctrl.size(); i++) {
+      if (ctrl[i] >= 0) {
+        auto hash = Hash()(slots[i].key);
+        auto index = freeSlot(hash);
+        ctrl_[index] = tag(hash);
+        slots_[index] = slots[i];
+      }
+    }
+  }
+
+  /**
+   * Control bytes, one per slot.
+   */
+  std::vector<int8_t> ctrl_;
+
+  /**
+   * Slots, valid where the control byte is a tag.
+   */
+  std::vector<Slot> slots_;
+
+  size_t size_ = 0;
+
+  /**
+   * Number of tombstones.
+   */
+  size_t deleted_ = 0;
+};
+
+#endif
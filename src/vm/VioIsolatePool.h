@@ -0,0 +1,152 @@
+/**
+ * Vio isolate pool.
+ */
+
+#ifndef VioIsolatePool_h
+#define VioIsolatePool_h
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VioParallel.h"
+#include "VioProgram.h"
+#include "VioVM.h"
+
+/**
+ * Runs independent scripts concurrently on a fixed set of worker
+ * threads.
+ *
+ * Each script runs in its own isolate: a VM created for it on the
+ * worker, with its own globals, stack, compiler and JIT. Isolates
+ * share no mutable state (the parser and compiler tables are
+ * immutable), so the workers only synchronize on the queue of scripts,
+ * and throughput scales with the number of cores. JIT compilation
+ * happens on the worker, not on a background thread per isolate.
+ *
+ * A script is either a source, parsed and compiled in its isolate, or
+ * a VioProgram compiled once and shared by all isolates running it.
+ *
+ * An isolate's objects are freed with it, so the result of a script
+ * is a copy of its value (IsolateValue): numbers and booleans, and
+ * strings and arrays by their contents. Other objects don't outlive
+ * the isolate, their result is NONE.
+ */
+class VioIsolatePool {
+ public:
+  explicit VioIsolatePool(size_t threads = std::thread::hardware_concurrency(),
+                          OptLevel level = OptLevel::O1)
+      : level_(level) {
+    if (threads == 0) {
+      threads = 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  /**
+   * Runs the queued scripts, then stops the workers.
+   */
+  ~VioIsolatePool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  VioIsolatePool(const VioIsolatePool&) = delete;
+  VioIsolatePool& operator=(const VioIsolatePool&) = delete;
+
+  /**
+   * Queues a script, to run in a new isolate. The future gets its
+   * result.
+   */
+  std::future<IsolateValue> submit(const std::string& program) {
+    return enqueue(Script{program, nullptr, {}});
+  }
+
+  /**
+   * Queues a run of a shared program, in a new isolate.
+   */
+  std::future<IsolateValue> submit(std::shared_ptr<const VioProgram> program) {
+    return enqueue(Script{"", std::move(program), {}});
+  }
+
+  /**
+   * Number of worker threads.
+   */
+  size_t size() const { return workers_.size(); }
+
+ private:
+  /**
+   * Script: a source, or a shared program.
+   */
+  struct Script {
+    std::string source;
+    std::shared_ptr<const VioProgram> program;
+    std::promise<IsolateValue> result;
+  };
+
+  std::future<IsolateValue> enqueue(Script script) {
+    auto result = script.result.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(script));
+    }
+    ready_.notify_one();
+    return result;
+  }
+
+  /**
+   * Worker loop: takes scripts off the queue until the pool stops.
+   */
+  void work() {
+    for (;;) {
+      Script script;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        script = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      script.result.set_value(run(script));
+    }
+  }
+
+  /**
+   * Runs a script in a new isolate, copies its result out.
+   */
+  IsolateValue run(const Script& script) {
+    auto vm = std::make_unique<VioVM>();
+    vm->setOptimizationLevel(level_);
+    vm->setTrace(false);
+    vm->setBackgroundCompilation(false);
+    auto entry = script.program != nullptr
+                     ? script.program->load(*vm)
+                     : vm->compileProgram(script.source);
+    return IsolateValue::from(vm->run(entry), {});
+  }
+
+  OptLevel level_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Script> queue_;
+  bool stopping_ = false;
+};
+
+#endif
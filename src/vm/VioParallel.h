@@ -0,0 +1,270 @@
+/**
+ * Vio parallel map.
+ */
+
+#ifndef VioParallel_h
+#define VioParallel_h
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "VioProgram.h"
+#include "VioVM.h"
+
+/**
+ * Value copied from one isolate to another: numbers and booleans as
+ * they are, strings and arrays by their contents, functions by the
+ * index of their code object in a shared program. Other objects (maps,
+ * fibers, natives) don't cross isolates.
+ */
+struct IsolateValue {
+  enum class Kind {
+    NONE,
+    PLAIN,
+    STRING,
+    ARRAY,
+    FUNCTION,
+  };
+
+  Kind kind = Kind::NONE;
+  VioValue plain;
+  std::string string;
+  std::vector<double> elements;
+  size_t code = 0;
+
+  /**
+   * Copy of a value, functions by the index of their code object.
+   */
+  static IsolateValue from(
+      const VioValue& value,
+      const std::unordered_map<CodeObject*, size_t>& indices) {
+    IsolateValue copy;
+    if (!IS_OBJECT(value)) {
+      copy.kind = Kind::PLAIN;
+      copy.plain = value;
+    } else if (IS_STRING(value)) {
+      copy.kind = Kind::STRING;
+      copy.string = AS_CPPSTRING(value);
+    } else if (IS_ARRAY(value)) {
+      copy.kind = Kind::ARRAY;
+      copy.elements = AS_ARRAY(value)->elements;
+    } else if (IS_FUNCTION(value) &&
+               indices.count(AS_FUNCTION(value)->co) != 0) {
+      copy.kind = Kind::FUNCTION;
+      copy.code = indices.at(AS_FUNCTION(value)->co);
+    }
+    return copy;
+  }
+
+  /**
+   * The value in the isolate of `codeObjects`.
+   */
+  VioValue to(const std::vector<CodeObject*>& codeObjects) const {
+    switch (kind) {
+      case Kind::STRING:
+        return ALLOC_STRING(string);
+      case Kind::ARRAY: {
+        auto array = ALLOC_ARRAY(0, 0);
+        AS_ARRAY(array)->elements = elements;
+        return array;
+      }
+      case Kind::FUNCTION:
+        return ALLOC_FUNCTION(codeObjects[code]);
+      default:
+        return plain;
+    }
+  }
+};
+
+/**
+ * Work-stealing queues of chunks: each worker starts with an even share
+ * of the chunks, takes them from the front of its own share, and once
+ * it's empty steals from the back of the others'.
+ */
+class ChunkQueues {
+ public:
+  ChunkQueues(size_t workers, size_t chunks) : ranges_(workers) {
+    for (size_t i = 0; i < workers; i++) {
+      ranges_[i].begin = chunks * i / workers;
+      ranges_[i].end = chunks * (i + 1) / workers;
+    }
+  }
+
+  /**
+   * Next chunk of a worker, false once all chunks are taken.
+   */
+  bool next(size_t worker, size_t& chunk) {
+    for (size_t i = 0; i < ranges_.size(); i++) {
+      auto& range = ranges_[(worker + i) % ranges_.size()];
+      std::lock_guard<std::mutex> lock(range.mutex);
+      if (range.begin < range.end) {
+        chunk = i == 0 ? range.begin++ : --range.end;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct Range {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  std::vector<Range> ranges_;
+};
+
+/**
+ * Calls a function of one argument on each element of an input, in
+ * worker isolates on all cores, and gathers the numeric results in
+ * order.
+ *
+ * The calling VM's code reachable from the function and from its
+ * global functions is written once to a shared VioProgram, and its
+ * globals are copied (IsolateValue). Each worker loads the program into
+ * a new isolate, so workers share nothing mutable: they only take
+ * chunks of the input and write their own slots of the results. The
+ * calling thread works as one of them. A worker's isolate, and all its
+ * objects, are freed when it's done; only the numbers come back.
+ */
+class VioParallelMap {
+ public:
+  VioParallelMap(VioVM& vm, FunctionObject* fn) : vm_(vm) {
+    std::vector<CodeObject*> roots{fn->co};
+    for (auto& global : vm.global->globals) {
+      if (IS_FUNCTION(global.value)) {
+        roots.push_back(AS_FUNCTION(global.value)->co);
+      }
+    }
+    std::vector<CodeObject*> codeObjects;
+    std::unordered_map<CodeObject*, size_t> indices;
+    if (!reachableCodeObjects(roots, codeObjects, indices)) {
+      DIE << "pmap: the code of the function can't be shared";
+    }
+    program_ = std::make_unique<VioProgram>(roots, *vm.global);
+
+    for (auto& global : vm.global->globals) {
+      globals_.push_back(IS_NATIVE(global.value)
+                             ? IsolateValue()
+                             : IsolateValue::from(global.value, indices));
+    }
+  }
+
+  /**
+   * Results of (fn x) for the `count` inputs, the elements of `array`,
+   * or the integers below `count` without it.
+   */
+  std::vector<double> run(const std::vector<double>* array, size_t count) {
+    std::vector<double> results(count);
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunkSize = std::max<size_t>(1, count / (cores * 8));
+    size_t chunks = (count + chunkSize - 1) / chunkSize;
+    size_t workers = std::max<size_t>(1, std::min(cores, chunks));
+
+    ChunkQueues queues(workers, chunks);
+    auto work = [&](size_t worker) {
+      // everything the worker allocates, the copies of the globals
+      // included, is freed with its isolate
+      VioVM isolate;
+      VioHeapScope scope(isolate.heap);
+      isolate.setOptimizationLevel(vm_.compiler->getOptimizationLevel());
+      isolate.compiler->setIncremental(true);
+      isolate.setTrace(false);
+      isolate.setQuickening(vm_.quickening);
+      isolate.setJit(vm_.jitEnabled);
+      isolate.setBackgroundCompilation(false);
+
+      std::vector<CodeObject*> codeObjects;
+      auto fn = program_->load(isolate, &codeObjects);
+      for (size_t i = 0; i < globals_.size(); i++) {
+        if (globals_[i].kind != IsolateValue::Kind::NONE) {
+          isolate.global->set(i, globals_[i].to(codeObjects));
+        }
+      }
+
+      // the call, on an argument in a global
+      isolate.global->define("__pmap_fn");
+      isolate.global->define("__pmap_arg");
+      isolate.global->set(isolate.global->getGlobalIndex("__pmap_fn"),
+                          (VioValue){VioValueType::OBJECT,
+                                     .object = (Object*)fn});
+      auto arg = isolate.global->getGlobalIndex("__pmap_arg");
+      auto call = isolate.compileProgram("(__pmap_fn __pmap_arg)");
+
+      size_t chunk;
+      while (queues.next(worker, chunk)) {
+        auto end = std::min(count, (chunk + 1) * chunkSize);
+        for (auto i = chunk * chunkSize; i < end; i++) {
+          isolate.global->set(arg, array != nullptr ? NUMBER((*array)[i])
+                                                    : INTEGER((int64_t)i));
+          auto result = isolate.run(call);
+          if (!IS_NUMERIC(result)) {
+            DIE << "pmap: " << fn->co->name << " returned "
+                << vioValueToConstantString(result) << ", not a number";
+          }
+          results[i] = AS_DOUBLE(result);
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; i++) {
+      threads.emplace_back(work, i);
+    }
+    work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return results;
+  }
+
+ private:
+  VioVM& vm_;
+
+  /**
+   * Code shared by the workers.
+   */
+  std::unique_ptr<VioProgram> program_;
+
+  /**
+   * Copies of the globals, NONE for natives and the objects which
+   * don't cross isolates.
+   */
+  std::vector<IsolateValue> globals_;
+};
+
+/**
+ * Natives of parallel maps.
+ */
+inline void VioVM::setParallelFunctions() {
+  // (pmap f xs): array of (f x) for each element x of the array xs, or
+  // each integer below the count xs, in parallel isolates
+  global->addNativeFunction(
+    "pmap",
+    [&]() {
+      auto callee = peek(1);
+      if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->co->arity != 1) {
+        DIE << "pmap: argument 1 is not a function of one argument";
+      }
+      if (AS_FUNCTION(callee)->co->codeSize() == 0) {
+        DIE << "pmap: " << AS_FUNCTION(callee)->co->name
+            << " has no bytecode (compiled to C++)";
+      }
+      auto input = IS_ARRAY(peek(0)) ? &AS_ARRAY(peek(0))->elements : nullptr;
+      auto count = input != nullptr ? input->size() : sizeArg("pmap", 2, 1);
+
+      auto results = ALLOC_ARRAY(0, 0);
+      AS_ARRAY(results)->elements =
+          VioParallelMap(*this, AS_FUNCTION(callee)).run(input, count);
+      push(results);
+    },
+  2);
+}
+
+#endif
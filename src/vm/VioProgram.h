@@ -0,0 +1,113 @@
+/**
+ * Vio shared programs.
+ */
+
+// Before the guard: VioVM.h includes VioParallel.h, which needs this
+// file, so VioVM comes first whichever header is included first.
+#include "VioVM.h"
+
+#ifndef VioProgram_h
+#define VioProgram_h
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Compiled program, shared read-only by isolates.
+ *
+ * The program is parsed and compiled once, into a bytecode image (code,
+ * constants and the layout of the global names, see VioImage) held in
+ * an anonymous in-memory file. Each isolate maps the file privately and
+ * runs the code in place, like a cached image: isolates share the
+ * physical pages of the code, and quickening only copies the pages it
+ * rewrites into the isolate. Constants are resolved in each isolate on
+ * first use, so strings and functions are allocated by the isolate,
+ * and the globals are defined in its own Global.
+ *
+ * The object is immutable once compiled: isolates on any thread can
+ * load it at once.
+ */
+class VioProgram {
+ public:
+  /**
+   * Compiles a program (in a scratch VM, which has the predefined
+   * globals of the isolates).
+   */
+  VioProgram(const std::string& source, OptLevel level = OptLevel::O1)
+      : key_(VioCodeCache::key(source, (int)level)) {
+    VioVM vm;
+    vm.setOptimizationLevel(level);
+    auto entry = vm.compileProgram(source);
+    store(VioImageWriter().write(key_, entry, *vm.global));
+  }
+
+  /**
+   * Program of code objects already compiled in a VM: the ones
+   * reachable from `roots`, the first root as the entry, with the
+   * layout of the VM's globals.
+   */
+  VioProgram(const std::vector<CodeObject*>& roots, Global& global)
+      : key_(0) {
+    store(VioImageWriter().write(key_, roots, global));
+  }
+
+  ~VioProgram() { close(fd_); }
+
+  VioProgram(const VioProgram&) = delete;
+  VioProgram& operator=(const VioProgram&) = delete;
+
+  /**
+   * Loads the program into an isolate: defines its globals, and returns
+   * its entry function. `codeObjects` gets the isolate's code objects,
+   * in the order of reachableCodeObjects.
+   */
+  FunctionObject* load(VioVM& vm,
+                       std::vector<CodeObject*>* codeObjects = nullptr) const {
+    auto image = std::make_unique<VioImage>();
+    if (!image->map(fd_, key_)) {
+      DIE << "VioProgram: can't map the program";
+    }
+    auto entry = vm.loadImage(std::move(image), codeObjects);
+    if (entry == nullptr) {
+      DIE << "VioProgram: the globals of the VM don't match the program's";
+    }
+    return entry;
+  }
+
+  /**
+   * Size of the image, shared by the isolates.
+   */
+  size_t size() const { return size_; }
+
+ private:
+  /**
+   * Writes the image to a new in-memory file.
+   */
+  void store(const std::string& image) {
+    if (image.empty()) {
+      DIE << "VioProgram: the program can't be stored as an image";
+    }
+    fd_ = memfd_create("vio-program", MFD_CLOEXEC);
+    if (fd_ == -1) {
+      DIE << "VioProgram: can't create the program file";
+    }
+    for (size_t written = 0; written < image.size();) {
+      auto count = write(fd_, image.data() + written, image.size() - written);
+      if (count <= 0) {
+        DIE << "VioProgram: can't write the program file";
+      }
+      written += count;
+    }
+    size_ = image.size();
+  }
+
+  uint64_t key_;
+  int fd_ = -1;
+  size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * Vio interpreter session.
+ */
+
+#ifndef VioSession_h
+#define VioSession_h
+
+#include <string>
+
+#include "VioVM.h"
+
+/**
+ * Long-lived session of a VM.
+ *
+ * Each snippet is parsed, compiled and run on its own, against the
+ * globals and functions defined by the previous ones: only the new
+ * code objects go through the compiler and the IR pipeline, and
+ * nothing is disassembled or traced.
+ */
+class VioSession {
+ public:
+  VioSession(OptLevel level = OptLevel::O1) {
+    vm_.setOptimizationLevel(level);
+    vm_.compiler->setIncremental(true);
+    vm_.setTrace(false);
+  }
+
+  /**
+   * Compiles and runs a snippet, returns its value.
+   */
+  VioValue eval(const std::string& snippet) {
+    return vm_.run(vm_.compileProgram(snippet));
+  }
+
+  /**
+   * Underlying VM.
+   */
+  VioVM& vm() { return vm_; }
+
+ private:
+  VioVM vm_;
+};
+
+#endif
@@ -5,16 +5,24 @@
 #ifndef VioVM_h
 #define VioVM_h
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <deque>
+#include <memory>
 #include <stack>
 #include <string>
 #include <vector>
 
 #include "../Logger.h"
 #include "../bytecode/OpCode.h"
+#include "../cache/VioCodeCache.h"
 #include "../compiler/VioCompiler.h"
+#include "../jit/VioCompilerThread.h"
+#include "../jit/VioJit.h"
 // #include "../gc/VioCollector.h"
 #include "../parser/VioParser.h"
+#include "VioArrayKernels.h"
 #include "VioValue.h"
 // #include "Global.h"
 
@@ -33,7 +41,7 @@ using syntax::VioParser;
 /**
  * Converts bytecode index to a pointer.
  */
-#define TO_ADDRESS(index) (&fn->co->code[index])
+#define TO_ADDRESS(index) (fn->co->codeBegin() + (index))
 
 /**
  * Gets a constant from the pool.
@@ -44,6 +52,53 @@ using syntax::VioParser;
  */
 #define STACK_LIMIT 512
 
+/**
+ * Stack segment of a fiber (values).
+ */
+#define FIBER_STACK_LIMIT 256
+
+/**
+ * Executions with number operands after which a generic
+ * instruction is quickened.
+ */
+#define QUICKEN_THRESHOLD 2
+
+/**
+ * Deoptimizations after which a site stays generic.
+ */
+#define QUICKEN_MAX_DEOPTS 4
+
+/**
+ * Callee changes after which a call site stops caching (megamorphic).
+ */
+#define CALL_MAX_MISSES 4
+
+/**
+ * Calls and loop back edges after which a code object is quickened.
+ */
+#define TIER_QUICKEN_THRESHOLD 1
+
+/**
+ * Calls after which a function is JIT-compiled.
+ */
+#define JIT_THRESHOLD 100
+
+/**
+ * Iterations of a loop after which its code object is JIT-compiled,
+ * and entered in the middle of the loop (on-stack replacement).
+ */
+#define OSR_THRESHOLD 100
+
+/**
+ * Failed guards of native code after which it's dropped.
+ */
+#define DEOPT_THRESHOLD 64
+
+/**
+ * Drops of native code after which a code object stays interpreted.
+ */
+#define TIER_MAX_DEOPTS 2
+
 /**
  * Memory threshold after which GC is triggered.
  */
@@ -55,35 +110,72 @@ using syntax::VioParser;
 // #define MEM(allocator, ...)  (maybeGC(), allocator(__VA_ARGS__))
 
 /**
- * Binary operation.
+ * Binary operation `generic`, quickened to `quickened` on stable
+ * number operands.
  */
-#define BINARY_OP(op)                         \
+#define BINARY_OP(generic, quickened)         \
   do {                                        \
-      auto op1 = pop();                       \
       auto op2 = pop();                       \
-      if (IS_NUMBER(op1) && IS_NUMBER(op2)) { \
-        auto v2 = AS_NUMBER(op2);             \
-        auto v1 = AS_NUMBER(op1);             \
-        push(NUMBER(v1 op v2));\
+      auto op1 = pop();                       \
+      auto numbers = IS_NUMERIC(op1) && IS_NUMERIC(op2); \
+      quicken(ip - 1, numbers, quickened);    \
+      if (numbers) {                          \
+        push(numericOp(generic, op1, op2));   \
       }                                       \
       else if (IS_STRING(op1) && IS_STRING(op2)) {  \
-        auto s1 = AS_CPPSTRING(op2);                \
-        auto s2 = AS_CPPSTRING(op1);                \
+        auto s1 = AS_CPPSTRING(op1);                \
+        auto s2 = AS_CPPSTRING(op2);                \
         push(ALLOC_STRING(s1 + s2));                \
       }                                             \
   } while (false)
 
+/**
+ * Quickened binary operation on numbers, in place on the stack.
+ * Deoptimizes to the `generic` opcode and re-executes it otherwise.
+ */
+#define NUMBER_OP(generic)                          \
+  do {                                              \
+    auto& op1 = sp[-2];                             \
+    auto& op2 = sp[-1];                             \
+    if (!IS_NUMERIC(op1) || !IS_NUMERIC(op2)) {     \
+      deoptimize(--ip, generic);                    \
+      break;                                        \
+    }                                               \
+    op1 = numericOp(generic, op1, op2);             \
+    sp--;                                           \
+  } while (false)
+
+/**
+ * Quickened comparison of numbers, the operator operand is skipped.
+ */
+#define NUMBER_COMPARE(op)                          \
+  do {                                              \
+    auto& op1 = sp[-2];                             \
+    auto& op2 = sp[-1];                             \
+    if (IS_INTEGER(op1) && IS_INTEGER(op2)) {       \
+      op1 = BOOLEAN(op1.integer op op2.integer);    \
+    } else if (IS_NUMBER(op1) && IS_NUMBER(op2)) {  \
+      op1 = BOOLEAN(op1.number op op2.number);      \
+    } else if (IS_NUMERIC(op1) && IS_NUMERIC(op2)) { \
+      op1 = BOOLEAN(numericCompare(*ip, op1, op2)); \
+    } else {                                        \
+      deoptimize(--ip, OP_COMPARE);                 \
+      break;                                        \
+    }                                               \
+    ip++;                                           \
+    sp--;                                           \
+  } while (false)
+
 // push(MEM(ALLOC_STRING(s1 + s2))); 
 // auto op2 = AS_NUMBER(pop()); \
 //     auto op1 = AS_NUMBER(pop()); \
 //     push(NUMBER(op1 op op2)); \
 
 /**
- * Generic values comparison.
+ * Generic values comparison, into `res`.
  */
-#define COMPARE_VALUES(op, v1, v2)  \
+#define COMPARE_RESULT(op, v1, v2)  \
   do {                              \
-    bool res;                       \
     switch (op) {                   \
       case 0:                       \
         res = v1 < v2;              \
@@ -104,9 +196,83 @@ using syntax::VioParser;
         res = v1 != v2;             \
         break;                      \
     }                               \
+  } while (false)
+
+/**
+ * Generic values comparison.
+ */
+#define COMPARE_VALUES(op, v1, v2)  \
+  do {                              \
+    bool res;                       \
+    COMPARE_RESULT(op, v1, v2);     \
     push(BOOLEAN(res));             \
   } while (false)
 
+// --------------------------------------------------
+// Numbers: integers, promoted to doubles on overflow and on
+// division with a remainder.
+
+/**
+ * Integer arithmetic of a math opcode, false if the result
+ * isn't an integer.
+ */
+inline bool integerOp(uint8_t opcode, int64_t a, int64_t b, int64_t& result) {
+  switch (opcode) {
+    case OP_ADD:
+      return !__builtin_add_overflow(a, b, &result);
+    case OP_SUB:
+      return !__builtin_sub_overflow(a, b, &result);
+    case OP_MUL:
+      return !__builtin_mul_overflow(a, b, &result);
+    default:
+      if (b == 0 || (b == -1 && a == INT64_MIN) || a % b != 0) {
+        return false;
+      }
+      result = a / b;
+      return true;
+  }
+}
+
+/**
+ * Arithmetic of a math opcode on numbers or integers.
+ */
+inline VioValue numericOp(uint8_t opcode, const VioValue& a,
+                          const VioValue& b) {
+  int64_t result;
+  if (IS_INTEGER(a) && IS_INTEGER(b) &&
+      integerOp(opcode, a.integer, b.integer, result)) {
+    return INTEGER(result);
+  }
+  auto v1 = AS_DOUBLE(a);
+  auto v2 = AS_DOUBLE(b);
+  switch (opcode) {
+    case OP_ADD:
+      return NUMBER(v1 + v2);
+    case OP_SUB:
+      return NUMBER(v1 - v2);
+    case OP_MUL:
+      return NUMBER(v1 * v2);
+    default:
+      return NUMBER(v1 / v2);
+  }
+}
+
+/**
+ * Comparison (compare op as in OP_COMPARE) of numbers or integers.
+ * An integer and a double compare exactly, as long doubles.
+ */
+inline bool numericCompare(uint8_t op, const VioValue& a, const VioValue& b) {
+  bool res = false;
+  if (IS_INTEGER(a) && IS_INTEGER(b)) {
+    COMPARE_RESULT(op, a.integer, b.integer);
+  } else {
+    auto v1 = IS_INTEGER(a) ? (long double)a.integer : a.number;
+    auto v2 = IS_INTEGER(b) ? (long double)b.integer : b.number;
+    COMPARE_RESULT(op, v1, v2);
+  }
+  return res;
+}
+
 // --------------------------------------------------
 struct Frame {
   // return address of the caller
@@ -117,8 +283,126 @@ struct Frame {
 
   // refenrence to the running function
   FunctionObject* fn;
+
+  // whether the callee's value is below the args (OP_CALL), so the
+  // result replaces it on return
+  bool calleeSlot;
+};
+
+/**
+ * State of a fiber.
+ */
+enum class FiberState {
+  // not started yet
+  NEW,
+  // at a yield
+  SUSPENDED,
+  RUNNING,
+  // resumed another fiber, until it yields or returns
+  RESUMING,
+  DONE,
 };
 
+/**
+ * Fiber: a function call running on its own segment of the value
+ * stack, with its own frames. The VM switches between fibers by saving
+ * and restoring its registers (ip, sp, bp, fn and the call stack), so a
+ * switch costs a few stores and no OS thread.
+ */
+struct FiberObject : public Object {
+  /**
+   * Fiber of the VM's own stack (the main program).
+   */
+  FiberObject(VioValue* stackBase, size_t size)
+      : Object(ObjectType::FIBER),
+        stackBase(stackBase),
+        stackLimit(stackBase + size) {}
+
+  /**
+   * Fiber calling `callee` with `arg` on a new stack segment.
+   */
+  FiberObject(FunctionObject* callee, const VioValue& arg)
+      : Object(ObjectType::FIBER),
+        segment(new VioValue[FIBER_STACK_LIMIT]),
+        stackBase(segment.get()),
+        stackLimit(segment.get() + FIBER_STACK_LIMIT) {
+    stackBase[0] = arg;
+    ip = callee->co->codeBegin();
+    sp = stackBase + 1;
+    bp = stackBase;
+    fn = callee;
+  }
+
+  std::unique_ptr<VioValue[]> segment;
+  VioValue* stackBase;
+  VioValue* stackLimit;
+
+  /**
+   * Registers, saved while the fiber isn't running.
+   */
+  uint8_t* ip = nullptr;
+  VioValue* sp = nullptr;
+  VioValue* bp = nullptr;
+  FunctionObject* fn = nullptr;
+  std::stack<Frame> frames;
+
+  FiberState state = FiberState::NEW;
+
+  /**
+   * Fiber which resumed it (OP_RESUME), continued on its next yield.
+   */
+  FiberObject* resumer = nullptr;
+
+  /**
+   * Whether the scheduler runs it (spawned), rather than OP_RESUME.
+   */
+  bool scheduled = false;
+
+  /**
+   * Value passed to the fiber when it continues (the resume value or
+   * its own yielded value), its result once done.
+   */
+  VioValue transfer;
+};
+
+/**
+ * Thresholds of the tiers: calls and loop back edges to quicken, calls
+ * or iterations of one loop to JIT-compile, and failed guards to
+ * drop native code.
+ */
+struct TierThresholds {
+  uint32_t quickened = TIER_QUICKEN_THRESHOLD;
+  uint32_t native = JIT_THRESHOLD;
+  uint32_t osr = OSR_THRESHOLD;
+  uint32_t deopt = DEOPT_THRESHOLD;
+};
+
+/**
+ * Promotion (or deoptimization) of a code object to a tier.
+ */
+struct TierEvent {
+  CodeObject* co;
+  Tier from;
+  Tier to;
+
+  /**
+   * Native code installed at a loop back edge: the running frame
+   * continues in it from the loop header.
+   */
+  bool osr;
+};
+
+std::string tierToString(Tier tier) {
+  switch (tier) {
+    case Tier::INTERPRETED:
+      return "interpreted";
+    case Tier::QUICKENED:
+      return "quickened";
+    case Tier::NATIVE:
+      return "native";
+  }
+  return "unknown";
+}
 
 /**
  * Vio Virtual Machine.
@@ -128,7 +412,20 @@ class VioVM {
   VioVM() : 
             global(std::make_shared<Global>()),
             parser(std::make_unique<VioParser>()), 
-            compiler(std::make_unique<VioCompiler>(global)) {setGlobalVariables();}
+            compiler(std::make_unique<VioCompiler>(global)),
+            jit(std::make_unique<VioJit>()),
+            compilerThread(std::make_unique<VioCompilerThread>()),
+            mainFiber(stack.data(), STACK_LIMIT) {
+    VioHeapScope scope(heap);
+    setGlobalVariables();
+  }
+
+  /**
+   * Natives and code objects point back to the VM (`this`), so it
+   * stays where it was created.
+   */
+  VioVM(const VioVM&) = delete;
+  VioVM& operator=(const VioVM&) = delete;
   // parser(std::make_unique<VioParser>) 
   //     : global(std::make_shared<Global>()),
   //       parser(std::make_unique<VioParser>()),
@@ -138,9 +435,9 @@ class VioVM {
   // }
 
   /**
-   * VM shutdown.
+   * VM shutdown: `heap` is destroyed last, freeing the objects once
+   * nothing (the compiler thread included) uses them.
    */
-  // ~VioVM() { Traceable::cleanup(); }
 
   //----------------------------------------------------
   // Stack operations:
@@ -149,7 +446,7 @@ class VioVM {
    * Pushes a value onto the stack.
    */
   void push(const VioValue& value) {
-    if ((size_t)(sp - stack.begin()) == STACK_LIMIT) {
+    if (sp == stackLimit) {
       DIE << "push(): stack overflow error \n";
     }
     *sp = value;
@@ -160,7 +457,7 @@ class VioVM {
    * Pops a value from the stack.
    */
   VioValue pop() {
-    if (sp == stack.begin()){
+    if (sp == stackBase){
       DIE << "pop(): empty stack. \n";
     }
     --sp;
@@ -171,7 +468,7 @@ class VioVM {
    * Peeks an element from the stack.
    */
   VioValue peek(size_t offset = 0) {
-    if (sp == stack.begin()){
+    if (sp == stackBase){
       DIE << "peek(): empty stack. \n";
     }
     return *(sp - 1 - offset);
@@ -243,7 +540,7 @@ class VioVM {
    * Spawns a potential GC cycle.
    */
   // void maybeGC() {
-  //   if (Traceable::bytesAllocated < GC_TRESHOLD) {
+  //   if (heap.bytesAllocated < GC_TRESHOLD) {
   //     return;
   //   }
 
@@ -251,58 +548,172 @@ class VioVM {
   //   if (roots.size() == 0) {
   //     return;
   //   }
-  //   collector->gc(roots);
+  //   collector->gc(roots, heap);
   // }
 
   //----------------------------------------------------
   // Program execution
 
+  /**
+   * Sets compiler optimization level.
+   */
+  void setOptimizationLevel(OptLevel level) {
+    compiler->setOptimizationLevel(level);
+  }
+
+  /**
+   * Enables the bytecode cache in a directory.
+   */
+  void setCacheDirectory(const std::string& directory) {
+    cache = std::make_unique<VioCodeCache>(directory);
+  }
+
   /**
    * Executes a program.
    */
   VioValue exec(const std::string& program) {
+    VioHeapScope scope(heap);
+
+    // Start from the main entry point:
+    auto entry = loadCached(program);
+
+    if (entry == nullptr) {
+      entry = compileProgram(program);
+      storeCached(program, entry);
+    }
+
+    compiler->disassembleBytecode();
+    // constants.push_back(ALLOC_STRING("Hello "));
+    // constants.push_back(ALLOC_STRING("wORLD"));
+    // constants.push_back(NUMBER(42));
+    // constants.push_back(NUMBER(35));
+    // code = {OP_CONST, 0, OP_CONST, 1, OP_ADD, OP_HALT};
+    // code = {OP_CONST, 0, OP_HALT};
+    return run(entry);
+  }
+
+  /**
+   * Parses and compiles a program into a new main function.
+   * Globals and functions of previous programs stay defined.
+   */
+  FunctionObject* compileProgram(const std::string& program) {
+    VioHeapScope scope(heap);
+
     // 1. Parse the program
     auto ast = parser->parse("(begin " + program + ")");
 
     // 2. Compile program to bytecode
     compiler->compile(ast);
-    // co = compiler->compile(ast); 
-    
+    // co = compiler->compile(ast);
 
-    // Start from the main entry point:
-    fn = compiler->getMainFunction();
+    return compiler->getMainFunction();
+  }
+
+  /**
+   * Runs a main function from an empty stack.
+   */
+  VioValue run(FunctionObject* entry) {
+    VioHeapScope scope(heap);
+    fn = entry;
 
     // Set instruction pointer to the beginning:
-    ip = &fn->co->code[0];
+    fn->co->resolve();
+    ip = fn->co->codeBegin();
     // ip = &co->code[0];
 
     // Init the stack:
+    fiber = &mainFiber;
+    fiber->state = FiberState::RUNNING;
+    stackBase = stack.data();
+    stackLimit = stackBase + STACK_LIMIT;
     sp = &stack[0];
 
     // Init the base (frame) pointer:
     bp = sp;
 
-    compiler->disassembleBytecode();
-    // constants.push_back(ALLOC_STRING("Hello "));
-    // constants.push_back(ALLOC_STRING("wORLD"));
-    // constants.push_back(NUMBER(42));
-    // constants.push_back(NUMBER(35));
-    // code = {OP_CONST, 0, OP_CONST, 1, OP_ADD, OP_HALT};
-    // code = {OP_CONST, 0, OP_HALT};
     return eval();
   }
 
+  /**
+   * Enables or disables dumping the stack on each instruction.
+   */
+  void setTrace(bool enabled) { trace = enabled; }
+
+  /**
+   * Entry function of the program from the cache, nullptr on a miss.
+   * Skips the parser and the compiler.
+   */
+  FunctionObject* loadCached(const std::string& program) {
+    if (cache == nullptr) {
+      return nullptr;
+    }
+    VioHeapScope scope(heap);
+    auto key = VioCodeCache::key(
+        program, (int)compiler->getOptimizationLevel());
+    std::vector<CodeObject*> codeObjects;
+    auto entry = cache->load(key, *global, codeObjects);
+    if (entry != nullptr) {
+      compiler->adopt(entry, codeObjects);
+    }
+    return entry;
+  }
+
+  /**
+   * Stores the compiled program in the cache (before it's quickened).
+   */
+  void storeCached(const std::string& program, FunctionObject* entry) {
+    if (cache == nullptr) {
+      return;
+    }
+    auto key = VioCodeCache::key(
+        program, (int)compiler->getOptimizationLevel());
+    cache->store(key, entry, *global);
+  }
+
+  /**
+   * Entry function of a mapped image (see VioProgram), nullptr if its
+   * globals don't extend the VM's. The VM keeps the image, its code
+   * objects execute in place; `loaded` gets them in image order.
+   */
+  FunctionObject* loadImage(std::unique_ptr<VioImage> image,
+                            std::vector<CodeObject*>* loaded = nullptr) {
+    VioHeapScope scope(heap);
+    std::vector<CodeObject*> codeObjects;
+    auto entry = image->load(*global, codeObjects);
+    if (entry != nullptr) {
+      compiler->adopt(entry, codeObjects);
+      images.push_back(std::move(image));
+      if (loaded != nullptr) {
+        *loaded = codeObjects;
+      }
+    }
+    return entry;
+  }
+
   /**
    * Main eval loop.
    */
   VioValue eval() {
     for (;;) {
-      dumpStack();
+      // run compiled code, unless it just exited to this instruction
+      if (fn->co->native != nullptr && ip != nativeExit) {
+        runNative();
+      }
+      if (trace) {
+        dumpStack();
+      }
       auto opcode = READ_BYTE();
       switch (opcode) {
 
         case OP_HALT: {
-          return pop();
+          if (runQueue.empty()) {
+            return pop();
+          }
+          // the spawned fibers run to completion first
+          mainFiber.transfer = pop();
+          mainFiber.state = FiberState::DONE;
+          continueFiber(nextScheduled());
+          break;
           // return;
         }
 
@@ -313,22 +724,22 @@ class VioVM {
 
         // math operations
         case OP_ADD: {
-          BINARY_OP(+);
+          BINARY_OP(OP_ADD, OP_ADD_NUM);
           break;
         }
 
         case OP_SUB: {
-          BINARY_OP(-);
+          BINARY_OP(OP_SUB, OP_SUB_NUM);
           break;
         }
 
         case OP_MUL: {
-          BINARY_OP(*);
+          BINARY_OP(OP_MUL, OP_MUL_NUM);
           break;
         }
 
         case OP_DIV: {
-          BINARY_OP(/);
+          BINARY_OP(OP_DIV, OP_DIV_NUM);
           break;
         }
         
@@ -337,10 +748,10 @@ class VioVM {
 
           auto op2 = pop();
           auto op1 = pop();
-          if (IS_NUMBER(op1) && IS_NUMBER(op2)) {
-            auto v1 = AS_NUMBER(op1);
-            auto v2 = AS_NUMBER(op2);
-            COMPARE_VALUES(op, v1, v2);
+          auto numbers = IS_NUMERIC(op1) && IS_NUMERIC(op2);
+          quicken(ip - 2, numbers, OP_LT_NUM + op);
+          if (numbers) {
+            push(BOOLEAN(numericCompare(op, op1, op2)));
           } else if (IS_STRING(op1) && IS_STRING(op2)) {
             auto s1 = AS_CPPSTRING(op1);
             auto s2 = AS_CPPSTRING(op2);
@@ -349,6 +760,57 @@ class VioVM {
           break;
         }
 
+        // quickened math and comparison
+        case OP_ADD_NUM: {
+          NUMBER_OP(OP_ADD);
+          break;
+        }
+
+        case OP_SUB_NUM: {
+          NUMBER_OP(OP_SUB);
+          break;
+        }
+
+        case OP_MUL_NUM: {
+          NUMBER_OP(OP_MUL);
+          break;
+        }
+
+        case OP_DIV_NUM: {
+          NUMBER_OP(OP_DIV);
+          break;
+        }
+
+        case OP_LT_NUM: {
+          NUMBER_COMPARE(<);
+          break;
+        }
+
+        case OP_GT_NUM: {
+          NUMBER_COMPARE(>);
+          break;
+        }
+
+        case OP_EQ_NUM: {
+          NUMBER_COMPARE(==);
+          break;
+        }
+
+        case OP_GE_NUM: {
+          NUMBER_COMPARE(>=);
+          break;
+        }
+
+        case OP_LE_NUM: {
+          NUMBER_COMPARE(<=);
+          break;
+        }
+
+        case OP_NE_NUM: {
+          NUMBER_COMPARE(!=);
+          break;
+        }
+
         case OP_JMP_IF_FALSE: {
           auto cond = AS_BOOLEAN(pop());
           auto address = READ_SHORT();
@@ -360,7 +822,11 @@ class VioVM {
         }
 
         case OP_JMP: {
-          ip = TO_ADDRESS(READ_SHORT());
+          auto address = TO_ADDRESS(READ_SHORT());
+          if (address < ip) {
+            countLoop(fn->co, address - fn->co->codeBegin());
+          }
+          ip = address;
           break;
         }
 
@@ -384,7 +850,7 @@ class VioVM {
 
         case OP_GET_LOCAL: {
           auto localIndex = READ_BYTE();
-          if (localIndex < 0 || localIndex >= stack.size()) {
+          if (bp + localIndex >= stackLimit) {
             DIE << "OP_GET_LOCAL: invalid variable index: " << (int)localIndex;
           }
           push(bp[localIndex]);
@@ -394,7 +860,7 @@ class VioVM {
         case OP_SET_LOCAL: {
           auto localIndex = READ_BYTE();
           auto value = peek(0);
-          if (localIndex < 0 || localIndex >= stack.size()) {
+          if (bp + localIndex >= stackLimit) {
             DIE << "OP_SET_LOCAL: invalid variable index: " << (int)localIndex;
           }
           bp[localIndex] = value;
@@ -411,12 +877,25 @@ class VioVM {
         }
 
         case OP_CALL: {
+          auto& site = fn->co->callSite(ip - 1 - fn->co->codeBegin());
           auto argsCount = READ_BYTE();
           auto fnValue = peek(argsCount);
 
+          // inline cache hit: the same function as on the last call
+          if (IS_OBJECT(fnValue) && fnValue.object == site.callee) {
+            enterFunction((FunctionObject*)site.callee, argsCount, site.entry,
+                          true);
+            break;
+          }
+
           // native function
           if (IS_NATIVE(fnValue)) {
-            AS_NATIVE(fnValue)->function();
+            auto native = AS_NATIVE(fnValue);
+            if (argsCount != native->arity) {
+              DIE << "OP_CALL: " << native->name << " expects "
+                  << native->arity << " arguments, got " << (int)argsCount;
+            }
+            native->function();
             auto result = pop();
 
             popN(argsCount+1); // pop args and function object itself
@@ -425,20 +904,43 @@ class VioVM {
           }
 
           // User-defined function
+          if (!IS_FUNCTION(fnValue)) {
+            DIE << "OP_CALL: not a function";
+          }
           auto callee = AS_FUNCTION(fnValue);
-          // save the execution context, restored on OP_RETURN
-          callStack.push(Frame{ip, bp, fn});
-
-          fn = callee;
-          // set base pointer to the callee
-          bp = sp - argsCount - 1;
-          // jump to the function code
-          ip = &callee->co->code[0];
-          
+          if (argsCount != callee->co->arity) {
+            DIE << "OP_CALL: " << callee->co->name << " expects "
+                << callee->co->arity << " arguments, got " << (int)argsCount;
+          }
+          callee->co->resolve();
+          if (site.misses < CALL_MAX_MISSES) {
+            site.misses += site.callee != nullptr;
+            site.callee = callee;
+            site.entry = callee->co->codeBegin();
+          }
+          enterFunction(callee, argsCount, callee->co->codeBegin(), true);
+          break;
+        }
+
+        case OP_CALL_DIRECT: {
+          // the arity is checked by the compiler, and only the args are
+          // on the stack
+          auto callee = AS_FUNCTION(GET_CONST());
+          auto argsCount = READ_BYTE();
+          callee->co->resolve();
+          enterFunction(callee, argsCount, callee->co->codeBegin(), false);
           break;
         }
 
         case OP_RETURN: {
+          // the function of a fiber returns
+          if (callStack.empty()) {
+            if (finishFiber()) {
+              return mainFiber.transfer;
+            }
+            break;
+          }
+
           // restore the caller address
           auto callerFrame = callStack.top();
 
@@ -447,16 +949,327 @@ class VioVM {
           bp = callerFrame.bp;
           fn = callerFrame.fn;
 
+          // the result replaces the callee's value
+          if (callerFrame.calleeSlot) {
+            *(sp - 2) = *(sp - 1);
+            sp--;
+          }
+
           callStack.pop();
           break;
         }
 
+        case OP_YIELD: {
+          auto value = pop();
+          if (fiber->resumer != nullptr) {
+            // back to the resumer, as the result of its OP_RESUME
+            auto resumer = fiber->resumer;
+            fiber->resumer = nullptr;
+            fiber->state = FiberState::SUSPENDED;
+            resumer->transfer = value;
+            continueFiber(resumer);
+          } else if (!runQueue.empty()) {
+            // to the next scheduled fiber, continues with its value
+            fiber->state = FiberState::SUSPENDED;
+            fiber->transfer = value;
+            runQueue.push_back(fiber);
+            continueFiber(nextScheduled());
+          } else {
+            push(value);
+          }
+          break;
+        }
+
+        case OP_RESUME: {
+          auto value = pop();
+          auto target = pop();
+          if (!IS_FIBER(target)) {
+            DIE << "OP_RESUME: not a fiber";
+          }
+          auto to = AS_FIBER(target);
+          if (to->scheduled) {
+            DIE << "OP_RESUME: the fiber is run by the scheduler";
+          }
+          if (to->state != FiberState::NEW &&
+              to->state != FiberState::SUSPENDED) {
+            DIE << "OP_RESUME: the fiber is "
+                << (to->state == FiberState::DONE ? "done" : "running");
+          }
+          to->resumer = fiber;
+          to->transfer = value;
+          fiber->state = FiberState::RESUMING;
+          continueFiber(to);
+          break;
+        }
+
         default:
           DIE << "Unknown opcode: " << std::hex << opcode;
       }
     }
   }
 
+  //----------------------------------------------------
+  // Fibers
+
+  /**
+   * Saves the registers of the running fiber, and continues `to`
+   * where it stopped: a started fiber gets its transfer value as the
+   * result of its OP_YIELD.
+   */
+  void continueFiber(FiberObject* to) {
+    fiber->ip = ip;
+    fiber->sp = sp;
+    fiber->bp = bp;
+    fiber->fn = fn;
+    fiber->frames.swap(callStack);
+
+    fiber = to;
+    ip = to->ip;
+    sp = to->sp;
+    bp = to->bp;
+    fn = to->fn;
+    callStack.swap(to->frames);
+    stackBase = to->stackBase;
+    stackLimit = to->stackLimit;
+
+    if (to->state != FiberState::NEW) {
+      push(to->transfer);
+    }
+    to->state = FiberState::RUNNING;
+  }
+
+  /**
+   * Takes the next fiber off the run queue.
+   */
+  FiberObject* nextScheduled() {
+    auto next = runQueue.front();
+    runQueue.pop_front();
+    return next;
+  }
+
+  /**
+   * The function of the running fiber returned: continues its
+   * resumer with the result, or the next scheduled fiber. Returns true
+   * once the main program halted and no fiber is left.
+   */
+  bool finishFiber() {
+    auto result = pop();
+    fiber->state = FiberState::DONE;
+    fiber->transfer = result;
+
+    if (fiber->resumer != nullptr) {
+      auto resumer = fiber->resumer;
+      fiber->resumer = nullptr;
+      resumer->transfer = result;
+      continueFiber(resumer);
+      return false;
+    }
+    if (!runQueue.empty()) {
+      continueFiber(nextScheduled());
+      return false;
+    }
+    if (mainFiber.state != FiberState::DONE) {
+      DIE << "finishFiber: no fiber to continue";
+    }
+    // back on the main stack, with its result
+    continueFiber(&mainFiber);
+    pop();
+    return true;
+  }
+
+  /**
+   * Creates a fiber calling a function of one argument: argument
+   * `index` of a native, and the one after it.
+   */
+  FiberObject* fiberArg(const char* name, size_t arity, size_t index) {
+    auto callee = peek(arity - 1 - index);
+    if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->co->arity != 1) {
+      DIE << name << ": argument " << index + 1
+          << " is not a function of one argument";
+    }
+    AS_FUNCTION(callee)->co->resolve();
+    countCall(AS_FUNCTION(callee)->co);
+    return new FiberObject(AS_FUNCTION(callee), peek(arity - 2 - index));
+  }
+
+  //----------------------------------------------------
+  // Quickening
+
+  /**
+   * Enables or disables quickening.
+   */
+  void setQuickening(bool enabled) { quickening = enabled; }
+
+  /**
+   * Records whether the generic instruction at `instr` saw number
+   * operands, and rewrites it to `quickened` once this is stable.
+   */
+  void quicken(uint8_t* instr, bool numbers, uint8_t quickened) {
+    if (!quickening || fn->co->tier == Tier::INTERPRETED) {
+      return;
+    }
+    auto& site = fn->co->quickenSite(instr - fn->co->codeBegin());
+    if (!numbers) {
+      site.hits = 0;
+      return;
+    }
+    if (site.deopts < QUICKEN_MAX_DEOPTS &&
+        ++site.hits >= QUICKEN_THRESHOLD) {
+      *instr = quickened;
+    }
+  }
+
+  // Tiers
+
+  /**
+   * Enables or disables the JIT.
+   */
+  void setJit(bool enabled) { jitEnabled = enabled; }
+
+  /**
+   * Compiles on a background thread (default), or on the VM thread.
+   */
+  void setBackgroundCompilation(bool enabled) { backgroundCompilation = enabled; }
+
+  void setTierThresholds(const TierThresholds& thresholds) {
+    tierThresholds = thresholds;
+  }
+
+  /**
+   * Called on the VM thread on each promotion.
+   */
+  void setTierListener(std::function<void(const TierEvent&)> listener) {
+    tierListener = std::move(listener);
+  }
+
+  /**
+   * Waits until the compiler thread is done with the code objects
+   * submitted so far.
+   */
+  void drainCompilerThread() { compilerThread->drain(); }
+
+  void countCall(CodeObject* co) {
+    co->calls++;
+    promote(co, false);
+  }
+
+  /**
+   * Counts a back edge to the loop at `header`.
+   */
+  void countLoop(CodeObject* co, size_t header) {
+    co->loops++;
+    promote(co, ++co->loopCount(header) >= tierThresholds.osr);
+  }
+
+  /**
+   * Promotes a code object through the tiers as it gets hot: generic
+   * bytecode, quickened bytecode, native code. Native code is
+   * installed once the compiler has published it, at a call or at a
+   * back edge (`loop`), where the running frame is transferred to it.
+   */
+  void promote(CodeObject* co, bool loop) {
+    if (co->tier == Tier::NATIVE) {
+      return;
+    }
+    if (co->tier == Tier::INTERPRETED) {
+      if (co->calls + co->loops < tierThresholds.quickened) {
+        return;
+      }
+      setTier(co, Tier::QUICKENED, false);
+    }
+
+    if (!co->compileRequested) {
+      auto hot = co->calls >= tierThresholds.native || loop;
+      if (!hot || !jitEnabled || trace || co->deopts >= TIER_MAX_DEOPTS) {
+        return;
+      }
+      co->compileRequested = true;
+      if (backgroundCompilation) {
+        compilerThread->submit(co, global->globals.size());
+        return;
+      }
+      co->compiled = jit->compile(co, global->globals.size());
+    }
+
+    auto native = co->compiled.load(std::memory_order_acquire);
+    if (native != nullptr) {
+      co->native = native;
+      setTier(co, Tier::NATIVE, loop);
+    }
+  }
+
+  /**
+   * Drops the native code of a code object whose guards keep failing
+   * (its operands changed type) back to quickened bytecode. It's
+   * compiled again once hot, up to TIER_MAX_DEOPTS times.
+   */
+  void demote(CodeObject* co) {
+    co->native = nullptr;
+    co->compiled = nullptr;
+    co->compileRequested = false;
+    co->guardFailures = 0;
+    co->deopts++;
+    co->calls = 0;
+    co->loopCounts.clear();
+    setTier(co, Tier::QUICKENED, false);
+  }
+
+  void setTier(CodeObject* co, Tier tier, bool osr) {
+    auto from = co->tier;
+    co->tier = tier;
+    if (tierListener) {
+      tierListener(TierEvent{co, from, tier, osr});
+    }
+  }
+
+  /**
+   * Runs the compiled code of the current function from `ip`, until
+   * it exits to the interpreter.
+   */
+  void runNative() {
+    auto native = fn->co->native;
+    if ((size_t)(stackLimit - sp) < native->maxStack) {
+      return;
+    }
+    JitState state{sp, bp, fn->co->constants.data(), global->globals.data()};
+    auto exit = native->run(&state, ip - fn->co->codeBegin());
+    sp = state.sp;
+    ip = nativeExit = fn->co->codeBegin() + exit;
+
+    // deoptimize: the interpreter runs the instruction of a failed guard
+    if (VioJit::guards(*ip) &&
+        ++fn->co->guardFailures >= tierThresholds.deopt) {
+      demote(fn->co);
+    }
+  }
+
+  /**
+   * Pushes a frame for the callee whose args are on the stack (above
+   * its value with `calleeSlot`), and jumps to its code at `entry`.
+   */
+  void enterFunction(FunctionObject* callee, size_t argsCount,
+                     uint8_t* entry, bool calleeSlot) {
+    // save the execution context, restored on OP_RETURN
+    callStack.push(Frame{ip, bp, fn, calleeSlot});
+    countCall(callee->co);
+
+    fn = callee;
+    // the frame starts at the args
+    bp = sp - argsCount;
+    // jump to the function code
+    ip = entry;
+  }
+
+  /**
+   * Rewrites the quickened instruction at `instr` back to `generic`.
+   */
+  void deoptimize(uint8_t* instr, uint8_t generic) {
+    auto& site = fn->co->quickenSite(instr - fn->co->codeBegin());
+    site.hits = 0;
+    site.deopts++;
+    *instr = generic;
+  }
+
   /**
    * Sets up global variables and function.
    */
@@ -464,11 +1277,16 @@ class VioVM {
     global->addNativeFunction(
       "native-square",
       [&]() {
-        auto x = AS_NUMBER(peek(0));
-        push(NUMBER(x * x));
+        auto x = peek(0);
+        push(numericOp(OP_MUL, x, x));
       },
     1);
 
+    setArrayFunctions();
+    setMapFunctions();
+    setFiberFunctions();
+    setParallelFunctions();
+
     // global->addConst("VERSION", 1);
     // global->define("x");
     // global->set(0, NUMBER(10));
@@ -476,6 +1294,344 @@ class VioVM {
     global->addGlobal("y", 20);
   }
 
+  /**
+   * Natives of Float64 arrays. Bulk operations run the SIMD kernels
+   * of the CPU (ArrayKernels::best), and return new arrays.
+   */
+  void setArrayFunctions() {
+    // (make-array n x): n copies of x
+    global->addNativeFunction(
+      "make-array",
+      [&]() {
+        auto size = sizeArg("make-array", 2, 0);
+        push(ALLOC_ARRAY(size, numberArg("make-array", 2, 1)));
+      },
+    2);
+    // (array-range n): 0, 1, ..., n - 1
+    global->addNativeFunction(
+      "array-range",
+      [&]() {
+        auto array = ALLOC_ARRAY(sizeArg("array-range", 1, 0), 0);
+        auto& elements = AS_ARRAY(array)->elements;
+        for (size_t i = 0; i < elements.size(); i++) {
+          elements[i] = i;
+        }
+        push(array);
+      },
+    1);
+    global->addNativeFunction(
+      "array-length",
+      [&]() {
+        push(INTEGER((int64_t)arrayArg("array-length", 1, 0)->elements.size()));
+      },
+    1);
+    global->addNativeFunction(
+      "array-get",
+      [&]() {
+        auto array = arrayArg("array-get", 2, 0);
+        push(NUMBER(array->elements[indexArg("array-get", 2, 1, array)]));
+      },
+    2);
+    // (array-set a i x): x
+    global->addNativeFunction(
+      "array-set",
+      [&]() {
+        auto array = arrayArg("array-set", 3, 0);
+        auto value = numberArg("array-set", 3, 2);
+        array->elements[indexArg("array-set", 3, 1, array)] = value;
+        push(NUMBER(value));
+      },
+    3);
+    global->addNativeFunction(
+      "array-sum",
+      [&]() {
+        auto& a = arrayArg("array-sum", 1, 0)->elements;
+        push(NUMBER(ArrayKernels::best().sum(a.data(), a.size())));
+      },
+    1);
+    global->addNativeFunction(
+      "array-dot",
+      [&]() {
+        auto& a = arrayArg("array-dot", 2, 0)->elements;
+        auto& b = sameSizeArg("array-dot", 2, 1, a)->elements;
+        push(NUMBER(ArrayKernels::best().dot(a.data(), b.data(), a.size())));
+      },
+    2);
+    global->addNativeFunction(
+      "array-scale",
+      [&]() {
+        auto& a = arrayArg("array-scale", 2, 0)->elements;
+        auto k = numberArg("array-scale", 2, 1);
+        auto result = ALLOC_ARRAY(a.size(), 0);
+        ArrayKernels::best().scale(a.data(), k,
+                                   AS_ARRAY(result)->elements.data(), a.size());
+        push(result);
+      },
+    2);
+    global->addNativeFunction(
+      "array-add",
+      [&]() {
+        auto& a = arrayArg("array-add", 2, 0)->elements;
+        auto& b = sameSizeArg("array-add", 2, 1, a)->elements;
+        auto result = ALLOC_ARRAY(a.size(), 0);
+        ArrayKernels::best().add(a.data(), b.data(),
+                                 AS_ARRAY(result)->elements.data(), a.size());
+        push(result);
+      },
+    2);
+    global->addNativeFunction(
+      "array-min",
+      [&]() {
+        auto& a = nonEmptyArg("array-min")->elements;
+        push(NUMBER(ArrayKernels::best().min(a.data(), a.size())));
+      },
+    1);
+    global->addNativeFunction(
+      "array-max",
+      [&]() {
+        auto& a = nonEmptyArg("array-max")->elements;
+        push(NUMBER(ArrayKernels::best().max(a.data(), a.size())));
+      },
+    1);
+    // (array-filter-gt a x): elements greater than x
+    global->addNativeFunction(
+      "array-filter-gt",
+      [&]() {
+        auto& a = arrayArg("array-filter-gt", 2, 0)->elements;
+        auto x = numberArg("array-filter-gt", 2, 1);
+        auto result = ALLOC_ARRAY(a.size() + 4, 0);
+        auto& out = AS_ARRAY(result)->elements;
+        out.resize(ArrayKernels::best().filterGt(a.data(), a.size(), x,
+                                                 out.data()));
+        out.shrink_to_fit();
+        push(result);
+      },
+    2);
+  }
+
+  /**
+   * Natives of maps, keyed by numbers and strings.
+   */
+  void setMapFunctions() {
+    global->addNativeFunction(
+      "make-map",
+      [&]() { push(ALLOC_MAP()); },
+    0);
+    global->addNativeFunction(
+      "map-size",
+      [&]() {
+        push(INTEGER((int64_t)mapArg("map-size", 1)->entries.size()));
+      },
+    1);
+    // (map-get m k): dies if k isn't in m
+    global->addNativeFunction(
+      "map-get",
+      [&]() {
+        auto value = mapArg("map-get", 2)->entries.find(
+            mapKeyArg("map-get", 2, 1));
+        if (value == nullptr) {
+          DIE << "map-get: no key " << vioValueToConstantString(peek(0));
+        }
+        push(*value);
+      },
+    2);
+    // (map-set m k v): v
+    global->addNativeFunction(
+      "map-set",
+      [&]() {
+        auto value = peek(0);
+        mapArg("map-set", 3)->entries.set(mapKeyArg("map-set", 3, 1), value);
+        push(value);
+      },
+    3);
+    global->addNativeFunction(
+      "map-has",
+      [&]() {
+        push(BOOLEAN(mapArg("map-has", 2)->entries.find(
+                         mapKeyArg("map-has", 2, 1)) != nullptr));
+      },
+    2);
+    // (map-delete m k): whether k was in m
+    global->addNativeFunction(
+      "map-delete",
+      [&]() {
+        push(BOOLEAN(mapArg("map-delete", 2)->entries.erase(
+            mapKeyArg("map-delete", 2, 1))));
+      },
+    2);
+  }
+
+  /**
+   * Natives of fibers. A spawned fiber is run by the scheduler: the
+   * fibers on the run queue take turns at each OP_YIELD (the main
+   * program is one of them), and the program ends once they are all
+   * done. Other fibers run on OP_RESUME.
+   */
+  void setFiberFunctions() {
+    // (spawn f x): fiber calling (f x), queued
+    global->addNativeFunction(
+      "spawn",
+      [&]() {
+        auto spawned = fiberArg("spawn", 2, 0);
+        spawned->scheduled = true;
+        runQueue.push_back(spawned);
+        push((VioValue){VioValueType::OBJECT, .object = (Object*)spawned});
+      },
+    2);
+    // (fiber f x): fiber calling (f x) on the first resume
+    global->addNativeFunction(
+      "fiber",
+      [&]() {
+        push((VioValue){VioValueType::OBJECT,
+                        .object = (Object*)fiberArg("fiber", 2, 0)});
+      },
+    2);
+    global->addNativeFunction(
+      "fiber-done",
+      [&]() {
+        push(BOOLEAN(fiberValueArg("fiber-done")->state == FiberState::DONE));
+      },
+    1);
+    // (fiber-result f): the return value of a done fiber
+    global->addNativeFunction(
+      "fiber-result",
+      [&]() {
+        auto done = fiberValueArg("fiber-result");
+        if (done->state != FiberState::DONE) {
+          DIE << "fiber-result: the fiber isn't done";
+        }
+        push(done->transfer);
+      },
+    1);
+  }
+
+  /**
+   * Natives of parallel maps (VioParallel.h).
+   */
+  void setParallelFunctions();
+
+  //----------------------------------------------------
+  // Arguments of natives: argument `index` of `arity`, on the stack.
+
+  /**
+   * Only argument, a fiber.
+   */
+  FiberObject* fiberValueArg(const char* name) {
+    auto value = peek(0);
+    if (!IS_FIBER(value)) {
+      DIE << name << ": argument 1 is not a fiber";
+    }
+    return AS_FIBER(value);
+  }
+
+  /**
+   * Array argument.
+   */
+  ArrayObject* arrayArg(const char* name, size_t arity, size_t index) {
+    auto value = peek(arity - 1 - index);
+    if (!IS_ARRAY(value)) {
+      DIE << name << ": argument " << index + 1 << " is not an array";
+    }
+    return AS_ARRAY(value);
+  }
+
+  /**
+   * Array argument of the size of `other`.
+   */
+  ArrayObject* sameSizeArg(const char* name, size_t arity, size_t index,
+                           const std::vector<double>& other) {
+    auto array = arrayArg(name, arity, index);
+    if (array->elements.size() != other.size()) {
+      DIE << name << ": arrays of sizes " << other.size() << " and "
+          << array->elements.size();
+    }
+    return array;
+  }
+
+  /**
+   * Only argument, a non-empty array.
+   */
+  ArrayObject* nonEmptyArg(const char* name) {
+    auto array = arrayArg(name, 1, 0);
+    if (array->elements.empty()) {
+      DIE << name << ": empty array";
+    }
+    return array;
+  }
+
+  /**
+   * First argument, a map.
+   */
+  MapObject* mapArg(const char* name, size_t arity) {
+    auto value = peek(arity - 1);
+    if (!IS_MAP(value)) {
+      DIE << name << ": argument 1 is not a map";
+    }
+    return AS_MAP(value);
+  }
+
+  /**
+   * Map key argument: a string, an integer, or a double (integral
+   * doubles are the same keys as integers).
+   */
+  VioValue mapKeyArg(const char* name, size_t arity, size_t index) {
+    auto key = peek(arity - 1 - index);
+    if (IS_STRING(key) || IS_INTEGER(key)) {
+      return key;
+    }
+    if (!IS_NUMBER(key) || key.number != key.number) {
+      DIE << name << ": key " << vioValueToConstantString(key)
+          << " is not a number or a string";
+    }
+    auto d = key.number;
+    if (std::trunc(d) == d && d >= -0x1p63 && d < 0x1p63) {
+      return INTEGER((int64_t)d);
+    }
+    return key;
+  }
+
+  /**
+   * Number (or integer) argument, as a double.
+   */
+  double numberArg(const char* name, size_t arity, size_t index) {
+    auto value = peek(arity - 1 - index);
+    if (!IS_NUMERIC(value)) {
+      DIE << name << ": argument " << index + 1 << " is not a number";
+    }
+    return AS_DOUBLE(value);
+  }
+
+  /**
+   * Non-negative integer argument.
+   */
+  size_t sizeArg(const char* name, size_t arity, size_t index) {
+    auto value = peek(arity - 1 - index);
+    if (!IS_INTEGER(value) || AS_INTEGER(value) < 0) {
+      DIE << name << ": argument " << index + 1
+          << " is not a non-negative integer";
+    }
+    return AS_INTEGER(value);
+  }
+
+  /**
+   * Integer argument, an index of `array`.
+   */
+  size_t indexArg(const char* name, size_t arity, size_t index,
+                  const ArrayObject* array) {
+    auto value = peek(arity - 1 - index);
+    if (!IS_INTEGER(value) || AS_INTEGER(value) < 0 ||
+        (uint64_t)AS_INTEGER(value) >= array->elements.size()) {
+      DIE << name << ": index " << vioValueToConstantString(value)
+          << " out of range of array of size " << array->elements.size();
+    }
+    return AS_INTEGER(value);
+  }
+
+  /**
+   * Objects allocated by the VM. Declared first: destroyed last.
+   */
+  VioHeap heap;
+
   /**
    * Global object.
    */
@@ -492,6 +1648,16 @@ class VioVM {
    */
   std::unique_ptr<VioCompiler> compiler;
 
+  /**
+   * Bytecode cache, nullptr if disabled.
+   */
+  std::unique_ptr<VioCodeCache> cache;
+
+  /**
+   * Images loaded with loadImage.
+   */
+  std::vector<std::unique_ptr<VioImage>> images;
+
   /**
    * Garbage collector.
    */
@@ -519,11 +1685,69 @@ class VioVM {
 
   std::vector<VioValue> constants;
 
+  /**
+   * Whether the stack is dumped on each instruction.
+   */
+  bool trace = true;
+
+  /**
+   * Whether generic instructions are quickened.
+   */
+  bool quickening = true;
+
+  /**
+   * Baseline JIT, on the VM thread.
+   */
+  std::unique_ptr<VioJit> jit;
+
+  /**
+   * Background compiler, started on the first request.
+   */
+  std::unique_ptr<VioCompilerThread> compilerThread;
+
+  /**
+   * Whether hot code objects are JIT-compiled (not while tracing).
+   */
+  bool jitEnabled = true;
+
+  bool backgroundCompilation = true;
+
+  TierThresholds tierThresholds;
+
+  std::function<void(const TierEvent&)> tierListener;
+
+  /**
+   * Instruction at which compiled code last exited, run by the
+   * interpreter before re-entering.
+   */
+  uint8_t* nativeExit = nullptr;
+
   /**
    * Separate stack for calls. Keeps return addresses.
    */
   std::stack<Frame> callStack;
 
+  /**
+   * Bounds of the stack segment of the running fiber.
+   */
+  VioValue* stackBase = stack.data();
+  VioValue* stackLimit = stack.data() + STACK_LIMIT;
+
+  /**
+   * The main program, on `stack`.
+   */
+  FiberObject mainFiber;
+
+  /**
+   * Running fiber.
+   */
+  FiberObject* fiber = &mainFiber;
+
+  /**
+   * Spawned fibers waiting for their turn.
+   */
+  std::deque<FiberObject*> runQueue;
+
   /**
    * Currently executing function.
    */
@@ -537,11 +1761,11 @@ class VioVM {
    */
   void dumpStack() {
     std::cout << "\n---stack---\n";
-    if (sp==stack.begin()) {
+    if (sp==stackBase) {
       std::cout << "(empty)";
     }
     auto csp = sp - 1;
-    while (csp >= stack.begin()) {
+    while (csp >= stackBase) {
       std::cout << *csp-- << "\n";
     }
     std::cout << "\n";
@@ -549,4 +1773,7 @@ class VioVM {
 
 };
 
-#endif
\ No newline at end of file
+// natives which run isolates of this VM
+#include "VioParallel.h"
+
+#endif
@@ -5,11 +5,16 @@
 #ifndef VioValue_h
 #define VioValue_h
 
+#include <atomic>
+#include <functional>
 #include <list>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <stdint.h>
 
+#include "VioHashTable.h"
+
 /**
  * Vio value type.
  */
@@ -17,6 +22,7 @@ enum class VioValueType {
   NUMBER,
   BOOLEAN,
   OBJECT,
+  INTEGER,
 };
 
 /**
@@ -30,85 +36,109 @@ enum class ObjectType {
   CELL,
   CLASS,
   INSTANCE,
+  ARRAY,
+  MAP,
+  FIBER,
 };
 
 // ----------------------------------------------------------------
 
+struct VioHeap;
+
 /**
  * Base traceable object.
  */
 struct Traceable {
+  virtual ~Traceable() = default;
+
   /**
    * Whether the object was marked during the trace.
    */
-  bool marked;
+  bool marked = false;
 
   /**
-   * Allocated size.
+   * Allocator: the object belongs to the heap of the running VM.
    */
-  size_t size;
+  static void* operator new(size_t size);
+};
 
-  /**
-   * Allocator.
-   */
-  static void* operator new(size_t size) {
-    void* object = ::operator new(size);
-    ((Traceable*)object)->size = size;
-    Traceable::objects.push_back((Traceable*)object);
-    Traceable::bytesAllocated += size;
+/**
+ * Objects allocated by a VM, freed when it shuts down.
+ *
+ * The heap of the VM running on a thread is `current()` (see
+ * VioHeapScope). Objects allocated with no VM running, e.g. by a
+ * compiler on its own, belong to no heap and are never freed.
+ */
+struct VioHeap {
+  VioHeap() = default;
+  VioHeap(const VioHeap&) = delete;
+  VioHeap& operator=(const VioHeap&) = delete;
 
-    return object;
-  }
+  ~VioHeap() { cleanup(); }
 
   /**
-   * Deallocator.
+   * Frees all objects.
    */
-  static void operator delete(void* object, std::size_t sz) {
-    Traceable::bytesAllocated -= ((Traceable*)object)->size;
-    // ::operator delete(object, sz);
+  void cleanup() {
+    for (auto& object : objects) {
+      delete object;
+    }
+    objects.clear();
+    bytesAllocated = 0;
   }
 
   /**
-   * Clean up for all objects.
+   * Heap of the VM running on this thread, nullptr if none.
    */
-  static void cleanup() {
-    for (auto&object: objects) {
-      delete object;
-    }
-    objects.clear();
+  static VioHeap*& current() {
+    static thread_local VioHeap* heap = nullptr;
+    return heap;
   }
 
   /**
    * Total number of allocated bytes.
    */
-  static size_t bytesAllocated;
+  size_t bytesAllocated = 0;
 
   /**
    * List of all allocated objects.
    */
-  static std::list<Traceable*> objects;
+  std::vector<Traceable*> objects;
 };
 
 /**
- * Total bytes allocated.
+ * Makes a heap current on this thread for a scope.
  */
-// size_t Traceable::bytesAllocated {0};
+class VioHeapScope {
+ public:
+  explicit VioHeapScope(VioHeap& heap) : previous_(VioHeap::current()) {
+    VioHeap::current() = &heap;
+  }
 
-/**
- * List of all allocated objects.
- */
-// std::list<Traceable*> Traceable::objects {};
+  ~VioHeapScope() { VioHeap::current() = previous_; }
+
+  VioHeapScope(const VioHeapScope&) = delete;
+  VioHeapScope& operator=(const VioHeapScope&) = delete;
+
+ private:
+  VioHeap* previous_;
+};
+
+inline void* Traceable::operator new(size_t size) {
+  auto object = ::operator new(size);
+  if (auto heap = VioHeap::current()) {
+    heap->objects.push_back((Traceable*)object);
+    heap->bytesAllocated += size;
+  }
+  return object;
+}
 
 // ----------------------------------------------------------------
 
 /**
  * Base object.
  */
-// struct Object : public Traceable {
-//   Object(ObjectType type) : type(type) {}
-//   ObjectType type;
-// };
-struct Object {
+struct Object : public Traceable {
   Object(ObjectType type) : type(type) {}
   ObjectType type;
 };
@@ -120,8 +150,15 @@ struct Object {
  */
 struct StringObject : public Object {
   StringObject(const std::string& str)
-    : Object(ObjectType::STRING), string(str) {}
+    : Object(ObjectType::STRING),
+      string(str),
+      hash(std::hash<std::string>()(str)) {}
   std::string string;
+
+  /**
+   * Hash of the string (strings are immutable), for map keys.
+   */
+  size_t hash;
 };
 
 // ----------------------------------------------------------------
@@ -145,6 +182,18 @@ struct NativeObject : public Object {
 
 // ----------------------------------------------------------------
 
+/**
+ * Array of unboxed doubles, contiguous for the bulk kernels
+ * (VioArrayKernels). Holds no references to other objects.
+ */
+struct ArrayObject : public Object {
+  ArrayObject(size_t size, double value)
+      : Object(ObjectType::ARRAY), elements(size, value) {}
+  std::vector<double> elements;
+};
+
+// ----------------------------------------------------------------
+
 /**
  * Vio value (tagged union).
  */
@@ -152,6 +201,7 @@ struct VioValue {
   VioValueType type;
   union {
     double number;
+    int64_t integer;
     bool boolean;
     Object* object;
   };
@@ -177,9 +227,119 @@ struct VioValue {
 
 // ----------------------------------------------------------------
 
+/**
+ * Hash of a map key: an integer, a non-integral double or a string
+ * (normalized by the map natives).
+ */
+struct MapKeyHash {
+  uint64_t operator()(const VioValue& key) const {
+    uint64_t h;
+    if (key.type == VioValueType::OBJECT) {
+      h = ((StringObject*)key.object)->hash;
+    } else {
+      h = (uint64_t)key.integer ^ (uint64_t)key.type;
+    }
+    // mix (murmur3 finalizer): the tag is the low bits
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+};
+
+/**
+ * Equality of map keys: strings by content.
+ */
+struct MapKeyEqual {
+  bool operator()(const VioValue& a, const VioValue& b) const {
+    if (a.type != b.type) {
+      return false;
+    }
+    if (a.type != VioValueType::OBJECT) {
+      return a.integer == b.integer;
+    }
+    auto s1 = (StringObject*)a.object;
+    auto s2 = (StringObject*)b.object;
+    return s1 == s2 || (s1->hash == s2->hash && s1->string == s2->string);
+  }
+};
+
+/**
+ * Map from numbers and strings to values (VioHashTable).
+ */
+struct MapObject : public Object {
+  MapObject() : Object(ObjectType::MAP) {}
+  VioHashTable<VioValue, VioValue, MapKeyHash, MapKeyEqual> entries;
+};
+
+// ----------------------------------------------------------------
+
 struct LocalVar {
   std::string name;
   size_t scopeLevel;
+
+  /**
+   * Stack slot relative to the frame base.
+   */
+  size_t slot;
+};
+
+struct NativeCode;
+
+/**
+ * Execution tier of a code object, promoted as it gets hot.
+ */
+enum class Tier : uint8_t {
+  /**
+   * Generic bytecode.
+   */
+  INTERPRETED,
+
+  /**
+   * Bytecode quickened on type feedback.
+   */
+  QUICKENED,
+
+  /**
+   * JIT-compiled native code.
+   */
+  NATIVE,
+};
+
+/**
+ * Type feedback of a quickenable instruction.
+ */
+struct QuickenSite {
+  /**
+   * Consecutive executions with number operands.
+   */
+  uint8_t hits = 0;
+
+  /**
+   * Times the quickened instruction was deoptimized.
+   */
+  uint8_t deopts = 0;
+};
+
+/**
+ * Monomorphic inline cache of a call instruction.
+ */
+struct CallSite {
+  /**
+   * Cached callee function, nullptr if none.
+   */
+  Object* callee = nullptr;
+
+  /**
+   * Entry point of the cached callee's code.
+   */
+  uint8_t* entry = nullptr;
+
+  /**
+   * Times the cached callee was replaced by another one.
+   */
+  uint8_t misses = 0;
 };
 
 /**
@@ -197,12 +357,129 @@ struct CodeObject : public Object {
   std::vector<uint8_t> code;
   size_t arity;
 
+  /**
+   * Code in a mapped bytecode image, executed in place of `code`.
+   */
+  uint8_t* mappedCode = nullptr;
+  size_t mappedCodeSize = 0;
+
+  /**
+   * Fills constants and locals of a code object loaded from an
+   * image, called once before first use.
+   */
+  std::function<void(CodeObject*)> resolver;
+
+  /**
+   * Start of the executable code.
+   */
+  uint8_t* codeBegin() {
+    return mappedCode != nullptr ? mappedCode : code.data();
+  }
+
+  size_t codeSize() {
+    return mappedCode != nullptr ? mappedCodeSize : code.size();
+  }
+
+  /**
+   * Resolves lazily loaded constants and locals.
+   */
+  void resolve() {
+    if (resolver) {
+      auto fn = std::move(resolver);
+      resolver = nullptr;
+      fn(this);
+    }
+  }
+
+  /**
+   * Constant pool indices by value, used for deduplication.
+   */
+  std::unordered_map<double, size_t> numberConstIndex;
+  std::unordered_map<int64_t, size_t> integerConstIndex;
+  std::unordered_map<std::string, size_t> stringConstIndex;
+  std::unordered_map<bool, size_t> booleanConstIndex;
+
   size_t scopeLevel = 0;
 
+  /**
+   * Operand stack depth at the current compile point.
+   */
+  int stackDepth = 0;
+
   std::vector<LocalVar> locals;
 
-  void addLocal(const std::string& name) {
-    locals.push_back({name, scopeLevel});
+  /**
+   * Quickening feedback by instruction offset, allocated on first use.
+   */
+  std::vector<QuickenSite> quickenSites;
+
+  QuickenSite& quickenSite(size_t offset) {
+    if (quickenSites.size() != codeSize()) {
+      quickenSites.resize(codeSize());
+    }
+    return quickenSites[offset];
+  }
+
+  /**
+   * Calls of the function and loop back edges executed by the
+   * interpreter.
+   */
+  uint32_t calls = 0;
+  uint32_t loops = 0;
+
+  Tier tier = Tier::INTERPRETED;
+
+  /**
+   * Back edges taken per loop, by loop header offset, allocated
+   * on first use.
+   */
+  std::vector<uint32_t> loopCounts;
+
+  uint32_t& loopCount(size_t header) {
+    if (loopCounts.size() != codeSize()) {
+      loopCounts.resize(codeSize());
+    }
+    return loopCounts[header];
+  }
+
+  /**
+   * Failed guards of the native code, and times it was dropped
+   * for them.
+   */
+  uint32_t guardFailures = 0;
+  uint8_t deopts = 0;
+
+  /**
+   * Whether the code object was submitted to the JIT.
+   */
+  bool compileRequested = false;
+
+  /**
+   * Native code published by the compiler thread, installed as
+   * `native` by the VM at the next call or loop back edge.
+   */
+  std::atomic<NativeCode*> compiled{nullptr};
+
+  /**
+   * JIT-compiled code, nullptr if not compiled (yet).
+   */
+  NativeCode* native = nullptr;
+
+  /**
+   * Call inline caches by instruction offset, allocated on first use.
+   */
+  std::vector<CallSite> callSites;
+
+  CallSite& callSite(size_t offset) {
+    if (callSites.size() != codeSize()) {
+      callSites.resize(codeSize());
+    }
+    return callSites[offset];
+  }
+
+  void addLocal(const std::string& name, int slot = -1) {
+    locals.push_back({name, scopeLevel,
+                      slot == -1 ? locals.size() : (size_t)slot});
     // (LocalVar)
   }
 
@@ -215,7 +492,7 @@ struct CodeObject : public Object {
     if (locals.size() > 0) {
       for (auto i = (int)locals.size() - 1; i >= 0; i--) {
         if (locals[i].name == name) {
-          return i;
+          return locals[i].slot;
         }
       }
     }
@@ -249,6 +526,7 @@ struct FunctionObject : public Object {
 // Constructors:
 
 #define NUMBER(value) ((VioValue){VioValueType::NUMBER, .number = value})
+#define INTEGER(value) ((VioValue){VioValueType::INTEGER, .integer = value})
 #define BOOLEAN(value) ((VioValue){VioValueType::BOOLEAN, .boolean = value})
 
 #define ALLOC_STRING(value) ((VioValue){VioValueType::OBJECT, .object = (Object*) new StringObject(value)})
@@ -257,11 +535,17 @@ struct FunctionObject : public Object {
 // #define ALLOC_CODE(name) ((VioValue){VioValueType::OBJECT, .object = (Object*) new CodeObject(name)})
 #define ALLOC_NATIVE(fn, name, arity) ((VioValue){VioValueType::OBJECT, .object = (Object*)new NativeObject(fn, name, arity)})
 #define ALLOC_FUNCTION(co) ((VioValue){VioValueType::OBJECT, .object = (Object*)new FunctionObject(co)})
+#define ALLOC_ARRAY(size, value) ((VioValue){VioValueType::OBJECT, .object = (Object*)new ArrayObject(size, value)})
+#define ALLOC_MAP() ((VioValue){VioValueType::OBJECT, .object = (Object*)new MapObject()})
 
 // ----------------------------------------------------------------
 // Accessors:
 
 #define AS_NUMBER(value) ((double)(value).number)
+#define AS_INTEGER(value) ((int64_t)(value).integer)
+// number or integer, as a double
+#define AS_DOUBLE(value) \
+  (IS_INTEGER(value) ? (double)(value).integer : (value).number)
 #define AS_BOOLEAN(value) ((bool)(value).boolean)
 #define AS_STRING(value) ((StringObject*)(value).object)
 #define AS_CPPSTRING(value) (AS_STRING(value) -> string)
@@ -269,6 +553,10 @@ struct FunctionObject : public Object {
 #define AS_NATIVE(value) ((NativeObject*)(value).object)
 #define AS_OBJECT(value) ((Object*) (value).object)
 #define AS_FUNCTION(value) ((FunctionObject*)(value).object)
+#define AS_ARRAY(value) ((ArrayObject*)(value).object)
+#define AS_MAP(value) ((MapObject*)(value).object)
+// FiberObject is defined with the VM's frames (VioVM.h)
+#define AS_FIBER(value) ((FiberObject*)(value).object)
 // ----------------------------------------------------------------
 // Testers:
 
@@ -278,11 +566,16 @@ struct FunctionObject : public Object {
 #define IS_OBJECT(value) ((value).type == VioValueType::OBJECT)
 
 #define IS_NUMBER(value) ((value).type == VioValueType::NUMBER)
+#define IS_INTEGER(value) ((value).type == VioValueType::INTEGER)
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INTEGER(value))
 #define IS_BOOLEAN(value) ((value).type == VioValueType::BOOLEAN)
 #define IS_STRING(value) IS_OBJECT_TYPE(value, ObjectType::STRING)
 #define IS_CODE(value) IS_OBJECT_TYPE(value, ObjectType::CODE)
 #define IS_NATIVE(value) IS_OBJECT_TYPE(value, ObjectType::NATIVE)
 #define IS_FUNCTION(value) IS_OBJECT_TYPE(value, ObjectType::FUNCTION)
+#define IS_ARRAY(value) IS_OBJECT_TYPE(value, ObjectType::ARRAY)
+#define IS_MAP(value) IS_OBJECT_TYPE(value, ObjectType::MAP)
+#define IS_FIBER(value) IS_OBJECT_TYPE(value, ObjectType::FIBER)
 
 // ----------------------------------------------------------------
 
@@ -292,6 +585,8 @@ struct FunctionObject : public Object {
 std::string vioValueToTypeString(const VioValue& vioValue) {
   if (IS_NUMBER(vioValue)) {
     return "NUMBER";
+  } else if (IS_INTEGER(vioValue)) {
+    return "INTEGER";
   } else if (IS_BOOLEAN(vioValue)) {
     return "BOOLEAN";
   } else if (IS_STRING(vioValue)) {
@@ -302,6 +597,12 @@ std::string vioValueToTypeString(const VioValue& vioValue) {
     return "NATIVE";
   } else if (IS_FUNCTION(vioValue)) {
     return "FUNCTION";
+  } else if (IS_ARRAY(vioValue)) {
+    return "ARRAY";
+  } else if (IS_MAP(vioValue)) {
+    return "MAP";
+  } else if (IS_FIBER(vioValue)) {
+    return "FIBER";
   } else {
     DIE << "vioValueToTypeString unkown type " << (int)vioValue.type;
   }
@@ -315,6 +616,8 @@ std::string vioValueToConstantString(const VioValue& vioValue) {
   std::stringstream ss;
   if (IS_NUMBER(vioValue)) {
     ss << vioValue.number;
+  } else if (IS_INTEGER(vioValue)) {
+    ss << vioValue.integer;
   } else if (IS_BOOLEAN(vioValue)) {
     ss << (vioValue.boolean == true ? "true" : "false");
   } else if (IS_STRING(vioValue)) {
@@ -328,6 +631,28 @@ std::string vioValueToConstantString(const VioValue& vioValue) {
   } else if (IS_NATIVE(vioValue)) {
     auto fn = AS_NATIVE(vioValue);
     ss << fn->name << "/" << fn->arity;
+  } else if (IS_ARRAY(vioValue)) {
+    // first elements of long arrays
+    auto& elements = AS_ARRAY(vioValue)->elements;
+    ss << "[";
+    for (size_t i = 0; i < elements.size() && i < 16; i++) {
+      ss << (i > 0 ? " " : "") << elements[i];
+    }
+    ss << (elements.size() > 16 ? " ...]" : "]");
+  } else if (IS_MAP(vioValue)) {
+    // first entries of large maps, in slot order
+    size_t count = 0;
+    ss << "{";
+    AS_MAP(vioValue)->entries.forEach([&](const VioValue& key, VioValue& value) {
+      if (count++ < 16) {
+        // nested maps aren't printed (they may contain this one)
+        ss << (count > 1 ? " " : "") << vioValueToConstantString(key) << ": "
+           << (IS_MAP(value) ? "{...}" : vioValueToConstantString(value));
+      }
+    });
+    ss << (count > 16 ? " ...}" : "}");
+  } else if (IS_FIBER(vioValue)) {
+    ss << "fiber" << vioValue.object;
   } else {
     DIE << "vioValueToConstantString unkown type " << (int)vioValue.type;
   }
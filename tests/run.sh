@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs the regression programs (tests/*.vio) at each optimization level,
+# with and without the JIT, and with the JIT at low tier thresholds so
+# short programs run in native code, and checks their results against
+# the `// expect: VALUE` line at the top of each.
+#
+#   clang++ -std=c++17 -O2 ./vio-vm.cpp -o ./vio-vm && tests/run.sh [./vio-vm]
+
+VM=${1:-./vio-vm}
+DIR=$(dirname "$0")
+failed=0
+
+for program in "$DIR"/*.vio; do
+  expected=$(sed -n 's|^// expect: ||p' "$program" | head -n 1)
+  for level in -O0 -O1 -O2; do
+    for jit in "" --no-jit "--tiers 1,2,2"; do
+      actual=$("$VM" --no-cache --no-trace --sync-jit $level $jit -f "$program" 2>&1 |
+        sed -n 's/^result = VioValue ([^)]*): //p')
+      if [ "$actual" != "$expected" ]; then
+        echo "FAIL $program $level $jit: expected $expected, got ${actual:-an error}"
+        failed=1
+      fi
+    done
+  done
+done
+
+[ $failed -eq 0 ] && echo "all passed"
+exit $failed
@@ -0,0 +1,890 @@
+/**
+ * Vio front-end benchmarks.
+ */
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "src/aot/VioCppEmitter.h"
+#include "src/bench/VioCorpusGenerator.h"
+#include "src/vm/VioIsolatePool.h"
+#include "src/vm/VioProgram.h"
+#include "src/vm/VioVM.h"
+
+using syntax::Tokenizer;
+using syntax::TokenType;
+using syntax::VioParser;
+
+// -----------------------------------------------------------------
+// Allocation tracking:
+
+/**
+ * Number of allocations on this thread since the start (per thread,
+ * so isolates on other threads don't contend on it).
+ */
+static thread_local size_t allocationsCount = 0;
+
+/**
+ * Number of bytes requested on this thread since the start.
+ */
+static thread_local size_t allocatedBytes = 0;
+
+// The replacements are the full matching set, and out of line: inlined
+// into callers, GCC would pair std::free with the new expression and
+// warn (-Wmismatched-new-delete).
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  allocationsCount++;
+  allocatedBytes += size;
+  if (auto p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept {
+  operator delete(p);
+}
+
+// -----------------------------------------------------------------
+
+/**
+ * Result of one measured phase.
+ */
+struct PhaseResult {
+  std::string name;
+  double seconds;
+  size_t sourceBytes;
+  size_t allocations;
+  size_t allocatedBytes;
+
+  /**
+   * Peak RSS of the process when the phase ended: a high-water mark
+   * over all the phases run so far, not the phase's own.
+   */
+  long processPeakRssKb;
+};
+
+/**
+ * Peak resident set size of the process since it started.
+ */
+long peakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * Runs a phase `iterations` times, keeps the fastest run.
+ * Allocations are reported per single run.
+ */
+template <typename Fn>
+PhaseResult measure(const std::string& name, size_t sourceBytes,
+                    size_t iterations, Fn fn) {
+  PhaseResult result{name, 0, sourceBytes, 0, 0, 0};
+  for (size_t i = 0; i < iterations; i++) {
+    auto allocationsBefore = allocationsCount;
+    auto bytesBefore = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+
+    fn();
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    if (i == 0 || seconds < result.seconds) {
+      result.seconds = seconds;
+    }
+    result.allocations = allocationsCount - allocationsBefore;
+    result.allocatedBytes = allocatedBytes - bytesBefore;
+  }
+  result.processPeakRssKb = peakRssKb();
+  return result;
+}
+
+/**
+ * Tokenizes the whole source.
+ */
+size_t tokenize(const std::string& source) {
+  Tokenizer tokenizer;
+  tokenizer.initString(source);
+  size_t tokens = 0;
+  while (tokenizer.getNextToken()->type != TokenType::__EOF) {
+    tokens++;
+  }
+  return tokens;
+}
+
+/**
+ * Prints a phase result as a JSON object.
+ */
+void printPhase(const PhaseResult& r, bool last) {
+  double mb = r.sourceBytes / (1024.0 * 1024.0);
+  std::cout << "        \"" << r.name << "\": {"
+            << "\"seconds\": " << r.seconds << ", "
+            << "\"mb_per_sec\": " << (r.seconds > 0 ? mb / r.seconds : 0)
+            << ", "
+            << "\"allocations\": " << r.allocations << ", "
+            << "\"allocated_bytes\": " << r.allocatedBytes << ", "
+            << "\"process_peak_rss_kb\": " << r.processPeakRssKb << "}" << (last ? "" : ",")
+            << "\n";
+}
+
+/**
+ * Benchmarks all front-end phases on one corpus.
+ */
+void benchCorpus(const std::string& shape, size_t size, size_t iterations,
+                 bool last) {
+  VioCorpusGenerator generator;
+  auto source = "(begin " + generator.generate(shape, size) + ")";
+
+  auto tokenizer = measure("tokenizer", source.size(), iterations,
+                           [&]() { tokenize(source); });
+
+  VioParser parser;
+  auto parserResult = measure("parser", source.size(), iterations,
+                              [&]() { parser.parse(source); });
+
+  auto ast = parser.parse(source);
+  auto compilerResult =
+      measure("compiler", source.size(), iterations, [&]() {
+        VioCompiler compiler(std::make_shared<Global>());
+        compiler.compile(ast);
+      });
+
+  std::cout << "    {\n"
+            << "      \"corpus\": \"" << shape << "\",\n"
+            << "      \"size\": " << size << ",\n"
+            << "      \"source_bytes\": " << source.size() << ",\n"
+            << "      \"phases\": {\n";
+  printPhase(tokenizer, false);
+  printPhase(parserResult, false);
+  printPhase(compilerResult, true);
+  std::cout << "      }\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Startup with the bytecode cache: cold (parse, compile and store)
+ * against warm (load from the cache) on one corpus.
+ */
+void benchStartup(const std::string& shape, size_t size, size_t iterations,
+                  const std::string& directory, bool last) {
+  VioCorpusGenerator generator;
+  auto program = generator.generate(shape, size);
+  VioCodeCache cache(directory);
+  auto key = VioCodeCache::key(program, (int)OptLevel::O1);
+
+  auto cold = measure("cold", program.size(), iterations, [&]() {
+    auto global = std::make_shared<Global>();
+    VioParser parser;
+    VioCompiler compiler(global);
+    compiler.compile(parser.parse("(begin " + program + ")"));
+    cache.store(key, compiler.getMainFunction(), *global);
+  });
+
+  auto warm = measure("warm", program.size(), iterations, [&]() {
+    auto global = std::make_shared<Global>();
+    std::vector<CodeObject*> codeObjects;
+    auto warmKey = VioCodeCache::key(program, (int)OptLevel::O1);
+    if (cache.load(warmKey, *global, codeObjects) == nullptr) {
+      DIE << "vio-bench: cache miss for " << shape;
+    }
+  });
+
+  std::cout << "    {\n"
+            << "      \"corpus\": \"" << shape << "\",\n"
+            << "      \"size\": " << size << ",\n"
+            << "      \"source_bytes\": " << program.size() << ",\n"
+            << "      \"cache_bytes\": "
+            << std::filesystem::file_size(cache.path(key)) << ",\n"
+            << "      \"speedup\": "
+            << (warm.seconds > 0 ? cold.seconds / warm.seconds : 0) << ",\n"
+            << "      \"phases\": {\n";
+  printPhase(cold, false);
+  printPhase(warm, true);
+  std::cout << "      }\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Numeric kernels of the execution benchmarks, by name.
+ */
+std::vector<std::pair<std::string, std::string>> executionKernels() {
+  return {
+      {"sum-loop",
+       "(var i 0) (var s 0) "
+       "(while (< i 1000000) (begin (set s (+ s (* i 3))) (set i (+ i 1)))) "
+       "s"},
+      {"nested-loops",
+       "(def grid (n) (begin (var i 0) (var s 0) "
+       "(while (< i n) (begin (var j 0) "
+       "(while (< j n) (begin (if (> (- i j) 0) (set s (+ s 1)) "
+       "(set s (- s 1))) (set j (+ j 1)))) (set i (+ i 1)))) s)) "
+       "(grid 1000)"},
+      {"fib",
+       "(def fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) "
+       "(fib 25)"},
+  };
+}
+
+/**
+ * Runs a program with or without the JIT, keeps the fastest run.
+ */
+PhaseResult measureRun(const std::string& name, const std::string& program,
+                       bool jit, size_t iterations) {
+  VioVM vm;
+  vm.setTrace(false);
+  vm.setJit(jit);
+  auto entry = vm.compileProgram(program);
+  return measure(name, program.size(), iterations, [&]() { vm.run(entry); });
+}
+
+/**
+ * JIT benchmark on one kernel: interpreter against native code, and
+ * the compile latency per code object.
+ */
+void benchJit(const std::string& name, const std::string& program,
+              size_t iterations, bool last) {
+  auto interpreter = measureRun("interpreter", program, false, iterations);
+  auto native = measureRun("jit", program, true, iterations);
+
+  VioVM vm;
+  vm.setTrace(false);
+  auto entry = vm.compileProgram(program);
+  std::vector<CodeObject*> codeObjects;
+  std::unordered_map<CodeObject*, size_t> indices;
+  reachableCodeObjects(entry->co, codeObjects, indices);
+
+  const size_t repeats = 100;
+  VioJit jit;
+  auto compile = measure("compile", 0, iterations, [&]() {
+    for (size_t i = 0; i < repeats; i++) {
+      for (auto co : codeObjects) {
+        jit.compile(co, vm.global->globals.size());
+      }
+    }
+  });
+  auto compiled = repeats * codeObjects.size();
+
+  std::cout << "    {\n"
+            << "      \"kernel\": \"" << name << "\",\n"
+            << "      \"code_objects\": " << codeObjects.size() << ",\n"
+            << "      \"interpreter_seconds\": " << interpreter.seconds
+            << ",\n"
+            << "      \"jit_seconds\": " << native.seconds << ",\n"
+            << "      \"speedup\": "
+            << (native.seconds > 0 ? interpreter.seconds / native.seconds : 0)
+            << ",\n"
+            << "      \"compile_us_per_code_object\": "
+            << compile.seconds * 1e6 / compiled << "\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * AOT benchmark on one kernel: interpreter and JIT against the
+ * program compiled to C++ (as a shared library, loaded in process),
+ * and the C++ build time.
+ */
+void benchAot(const std::string& name, const std::string& program,
+              size_t iterations, bool last) {
+  auto interpreter = measureRun("interpreter", program, false, iterations);
+  auto native = measureRun("jit", program, true, iterations);
+
+  VioVM vm;
+  auto entry = vm.compileProgram(program);
+  auto directory = std::filesystem::temp_directory_path() / "vio-bench-aot";
+  std::filesystem::create_directories(directory);
+  auto source = (directory / (name + ".cpp")).string();
+  auto library = (directory / (name + ".so")).string();
+  std::ofstream(source) << VioCppEmitter().emit(entry, *vm.global);
+
+  // the runtime headers are next to this file
+  auto root = std::filesystem::absolute(__FILE__).parent_path().string();
+  auto compiler = std::getenv("CXX") != nullptr ? std::getenv("CXX") : "c++";
+  auto command = std::string(compiler) +
+                 " -std=c++17 -O2 -fPIC -shared -DVIO_AOT_LIBRARY -I'" + root +
+                 "' '" + source + "' -o '" + library + "'";
+  auto start = std::chrono::steady_clock::now();
+  if (std::system(command.c_str()) != 0) {
+    DIE << "vio-bench: can't build " << source;
+  }
+  double buildSeconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+  auto handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+  auto vioMain = handle != nullptr
+                     ? (VioValue(*)())dlsym(handle, "vioMain")
+                     : nullptr;
+  if (vioMain == nullptr) {
+    DIE << "vio-bench: can't load " << library << ": " << dlerror();
+  }
+  auto aot = measure("aot", program.size(), iterations, [&]() { vioMain(); });
+
+  std::cout << "    {\n"
+            << "      \"kernel\": \"" << name << "\",\n"
+            << "      \"interpreter_seconds\": " << interpreter.seconds
+            << ",\n"
+            << "      \"jit_seconds\": " << native.seconds << ",\n"
+            << "      \"aot_seconds\": " << aot.seconds << ",\n"
+            << "      \"speedup\": "
+            << (aot.seconds > 0 ? interpreter.seconds / aot.seconds : 0)
+            << ",\n"
+            << "      \"build_seconds\": " << buildSeconds << "\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Size of the arrays of the array benchmarks.
+ */
+static const size_t arrayBenchSize = 100000;
+
+/**
+ * Array kernel: a Vio loop over the arrays `a` and `b`, the equivalent
+ * bulk native, and the C++ kernel call.
+ */
+struct ArrayBenchKernel {
+  std::string name;
+  std::string loop;
+  std::string bulk;
+  std::function<double(const ArrayKernels&, const std::vector<double>&,
+                       const std::vector<double>&, std::vector<double>&)>
+      run;
+};
+
+/**
+ * Array kernels of the array benchmark.
+ */
+std::vector<ArrayBenchKernel> arrayBenchKernels() {
+  auto loop = [](const std::string& init, const std::string& body,
+                 const std::string& result) {
+    return "(var i 0) " + init + " (while (< i n) (begin " + body +
+           " (set i (+ i 1)))) " + result;
+  };
+  return {
+      {"sum", loop("(var s 0)", "(set s (+ s (array-get a i)))", "s"),
+       "(array-sum a)",
+       [](auto& k, auto& a, auto&, auto&) { return k.sum(a.data(), a.size()); }},
+      {"dot",
+       loop("(var s 0)", "(set s (+ s (* (array-get a i) (array-get b i))))",
+            "s"),
+       "(array-dot a b)",
+       [](auto& k, auto& a, auto& b, auto&) {
+         return k.dot(a.data(), b.data(), a.size());
+       }},
+      {"scale",
+       loop("(var c (make-array n 0))",
+            "(array-set c i (* (array-get a i) 3))", "c"),
+       "(array-scale a 3)",
+       [](auto& k, auto& a, auto&, auto& out) {
+         k.scale(a.data(), 3, out.data(), a.size());
+         return out[0];
+       }},
+      {"add",
+       loop("(var c (make-array n 0))",
+            "(array-set c i (+ (array-get a i) (array-get b i)))", "c"),
+       "(array-add a b)",
+       [](auto& k, auto& a, auto& b, auto& out) {
+         k.add(a.data(), b.data(), out.data(), a.size());
+         return out[0];
+       }},
+      {"max",
+       loop("(var m (array-get a 0))",
+            "(if (> (array-get a i) m) (set m (array-get a i)))", "m"),
+       "(array-max a)",
+       [](auto& k, auto& a, auto&, auto&) { return k.max(a.data(), a.size()); }},
+      {"filter-gt",
+       loop("(var c (make-array n 0)) (var j 0)",
+            "(if (> (array-get a i) 50000) (begin (array-set c j (array-get "
+            "a i)) (set j (+ j 1))))",
+            "c"),
+       "(array-filter-gt a 50000)",
+       [](auto& k, auto& a, auto&, auto& out) {
+         return (double)k.filterGt(a.data(), a.size(), 50000, out.data());
+       }},
+  };
+}
+
+/**
+ * Array benchmark on one kernel: the interpreted loop against the bulk
+ * native, and the C++ kernel of each instruction set the CPU supports.
+ */
+void benchArrays(const ArrayBenchKernel& kernel, size_t iterations,
+                 bool last) {
+  auto run = [&](const std::string& name, const std::string& program) {
+    VioVM vm;
+    vm.setTrace(false);
+    vm.setJit(false);
+    vm.compiler->setIncremental(true);
+    vm.run(vm.compileProgram("(var n " + std::to_string(arrayBenchSize) +
+                             ") (var a (array-range n)) "
+                             "(var b (make-array n 2))"));
+    auto entry = vm.compileProgram(program);
+    return measure(name, program.size(), iterations, [&]() { vm.run(entry); });
+  };
+  auto loop = run("loop", kernel.loop);
+  auto bulk = run("bulk", kernel.bulk);
+
+  std::vector<double> a(arrayBenchSize), b(arrayBenchSize, 2),
+      out(arrayBenchSize + 4);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = i;
+  }
+  const size_t repeats = 100;
+  volatile double sink = 0;
+
+  std::cout << "    {\n"
+            << "      \"kernel\": \"" << kernel.name << "\",\n"
+            << "      \"elements\": " << arrayBenchSize << ",\n"
+            << "      \"interpreter_seconds\": " << loop.seconds << ",\n"
+            << "      \"native_seconds\": " << bulk.seconds << ",\n"
+            << "      \"speedup\": "
+            << (bulk.seconds > 0 ? loop.seconds / bulk.seconds : 0) << ",\n"
+            << "      \"dispatch\": \"" << ArrayKernels::best().name
+            << "\",\n"
+            << "      \"kernel_seconds\": {";
+  auto supported = ArrayKernels::supported();
+  for (size_t i = 0; i < supported.size(); i++) {
+    auto result = measure(supported[i]->name, 0, iterations, [&]() {
+      for (size_t r = 0; r < repeats; r++) {
+        sink = sink + kernel.run(*supported[i], a, b, out);
+      }
+    });
+    std::cout << (i > 0 ? ", " : "") << "\"" << supported[i]->name
+              << "\": " << result.seconds / repeats;
+  }
+  std::cout << "}\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Number of context switches of each fiber benchmark.
+ */
+static const size_t fiberBenchSwitches = 1000000;
+
+/**
+ * Fiber benchmarks, by name: a program doing `fiberBenchSwitches`
+ * switches, and the same loop with calls instead.
+ */
+std::vector<std::array<std::string, 3>> fiberBenchKernels() {
+  auto n = std::to_string(fiberBenchSwitches / 2);
+  auto fibers = std::to_string(fiberBenchSwitches / 1000);
+  return {
+      // resume and yield: two switches per iteration
+      {"generator",
+       "(def gen (x) (begin (var i 0) "
+       "(while (< i " + n + ") (begin (yield i) (set i (+ i 1)))) i)) "
+       "(var g (fiber gen 0)) (var i 0) (var s 0) "
+       "(while (< i " + n + ") (begin (set s (+ s (resume g 0))) "
+       "(set i (+ i 1)))) s",
+       "(def gen (x) x) (var i 0) (var s 0) "
+       "(while (< i " + n + ") (begin (set s (+ s (gen i))) "
+       "(set i (+ i 1)))) s"},
+      // spawned fibers yielding 1000 times each, round robin
+      {"scheduler",
+       "(def worker (k) (begin (var j 0) "
+       "(while (< j 1000) (begin (yield j) (set j (+ j 1)))) k)) "
+       "(var i 0) (while (< i " + fibers + ") (begin (spawn worker i) "
+       "(set i (+ i 1)))) 0",
+       "(def worker (k) (begin (var j 0) "
+       "(while (< j 1000) (begin (set j (+ j 1)))) k)) "
+       "(var i 0) (while (< i " + fibers + ") (begin (worker i) "
+       "(set i (+ i 1)))) 0"},
+  };
+}
+
+/**
+ * Fiber benchmark on one kernel, in the interpreter: time per context
+ * switch, the loop time without the switches taken out.
+ */
+void benchFibers(const std::array<std::string, 3>& kernel, size_t iterations,
+                 bool last) {
+  auto switches = measureRun("switches", kernel[1], false, iterations);
+  auto calls = measureRun("calls", kernel[2], false, iterations);
+  auto overhead = switches.seconds - calls.seconds;
+
+  std::cout << "    {\n"
+            << "      \"kernel\": \"" << kernel[0] << "\",\n"
+            << "      \"switches\": " << fiberBenchSwitches << ",\n"
+            << "      \"fiber_seconds\": " << switches.seconds << ",\n"
+            << "      \"call_seconds\": " << calls.seconds << ",\n"
+            << "      \"ns_per_switch\": "
+            << switches.seconds * 1e9 / fiberBenchSwitches << ",\n"
+            << "      \"switch_overhead_ns\": "
+            << (overhead > 0 ? overhead * 1e9 / fiberBenchSwitches : 0)
+            << "\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Isolate benchmark on one kernel: a batch of copies of the script on
+ * pools of 1, 2, 4... threads up to the number of cores, and the
+ * speedup over one thread. Then the startup of an isolate compiling
+ * the script, against one loading it as a shared VioProgram.
+ */
+void benchIsolates(const std::string& name, const std::string& program,
+                   size_t iterations, bool last) {
+  size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  size_t scripts = std::max<size_t>(16, 4 * cores);
+
+  std::cout << "    {\n"
+            << "      \"kernel\": \"" << name << "\",\n"
+            << "      \"scripts\": " << scripts << ",\n"
+            << "      \"pools\": [\n";
+  double single = 0;
+  for (size_t threads = 1;; threads = std::min(threads * 2, cores)) {
+    VioIsolatePool pool(threads);
+    auto batch = measure("batch", program.size(), iterations, [&]() {
+      std::vector<std::future<IsolateValue>> results;
+      for (size_t i = 0; i < scripts; i++) {
+        results.push_back(pool.submit(program));
+      }
+      for (auto& result : results) {
+        result.get();
+      }
+    });
+    if (threads == 1) {
+      single = batch.seconds;
+    }
+    auto speedup = batch.seconds > 0 ? single / batch.seconds : 0;
+    std::cout << "        {\"threads\": " << threads
+              << ", \"seconds\": " << batch.seconds
+              << ", \"scripts_per_sec\": "
+              << (batch.seconds > 0 ? scripts / batch.seconds : 0)
+              << ", \"speedup\": " << speedup
+              << ", \"efficiency\": " << speedup / threads << "}"
+              << (threads == cores ? "" : ",") << "\n";
+    if (threads == cores) {
+      break;
+    }
+  }
+  std::cout << "      ],\n";
+
+  // startup of an isolate: compiling the source, or loading the shared
+  // program
+  const size_t repeats = 100;
+  auto shared = std::make_shared<const VioProgram>(program);
+  auto compile = measure("compile", program.size(), iterations, [&]() {
+    for (size_t i = 0; i < repeats; i++) {
+      VioVM vm;
+      vm.compileProgram(program);
+    }
+  });
+  auto load = measure("shared", program.size(), iterations, [&]() {
+    for (size_t i = 0; i < repeats; i++) {
+      VioVM vm;
+      shared->load(vm);
+    }
+  });
+  std::cout << "      \"program_bytes\": " << shared->size() << ",\n"
+            << "      \"startup_us\": {\"compile\": "
+            << compile.seconds * 1e6 / repeats
+            << ", \"shared\": " << load.seconds * 1e6 / repeats << "},\n"
+            << "      \"allocated_bytes_per_isolate\": {\"compile\": "
+            << compile.allocatedBytes / repeats
+            << ", \"shared\": " << load.allocatedBytes / repeats << "}\n"
+            << "    }" << (last ? "" : ",") << "\n";
+}
+
+/**
+ * Parallel map benchmark: a loop calling a function on each integer
+ * below n, against pmap of the function over the range on all cores.
+ */
+void benchParallelMap(size_t iterations) {
+  auto work =
+      "(def work (i) (begin (var j 0) (var s 0) "
+      "(while (< j 2000) (begin (set s (+ s (* (- i j) (- i j)))) "
+      "(set j (+ j 1)))) s)) (var n 20000) ";
+  auto loop = measureRun(
+      "loop",
+      std::string(work) +
+          "(var r (make-array n 0)) (var i 0) "
+          "(while (< i n) (begin (array-set r i (work i)) (set i (+ i 1)))) "
+          "(array-sum r)",
+      true, iterations);
+  auto pmap = measureRun("pmap", std::string(work) + "(array-sum (pmap work n))",
+                         true, iterations);
+
+  std::cout << std::setprecision(6) << "{\n"
+            << "  \"benchmark\": \"pmap\",\n"
+            << "  \"iterations\": " << iterations << ",\n"
+            << "  \"cores\": " << std::thread::hardware_concurrency() << ",\n"
+            << "  \"elements\": 20000,\n"
+            << "  \"loop_seconds\": " << loop.seconds << ",\n"
+            << "  \"pmap_seconds\": " << pmap.seconds << ",\n"
+            << "  \"speedup\": "
+            << (pmap.seconds > 0 ? loop.seconds / pmap.seconds : 0) << "\n"
+            << "}\n";
+}
+
+/**
+ * Compile-time benchmark on a program with `count` distinct literals.
+ */
+void benchLiterals(size_t count, size_t iterations) {
+  VioCorpusGenerator generator;
+  auto asts = generator.literalsAsts(count);
+
+  auto compilerResult = measure("compiler", 0, iterations, [&]() {
+    for (auto& ast : asts) {
+      VioCompiler compiler(std::make_shared<Global>());
+      compiler.compile(ast);
+    }
+  });
+
+  std::cout << std::setprecision(6) << "{\n"
+            << "  \"benchmark\": \"compile-literals\",\n"
+            << "  \"iterations\": " << iterations << ",\n"
+            << "  \"literals\": " << count << ",\n"
+            << "  \"seconds\": " << compilerResult.seconds << ",\n"
+            << "  \"literals_per_sec\": "
+            << (compilerResult.seconds > 0 ? count / compilerResult.seconds
+                                           : 0)
+            << ",\n"
+            << "  \"allocations\": " << compilerResult.allocations << ",\n"
+            << "  \"process_peak_rss_kb\": " << compilerResult.processPeakRssKb << "\n"
+            << "}\n";
+}
+
+void printHelp() {
+  std::cout << "\nUsage: vio-bench [options]\n\n"
+            << "Options:\n"
+            << "    -c, --corpus      Corpus shape (default: all)\n"
+            << "    -s, --size        Corpus size (default: per shape)\n"
+            << "    -i, --iterations  Runs per phase (default: 3)\n"
+            << "    --emit            Print the generated corpus and exit\n"
+            << "    --literals N      Compile-only benchmark, N literals\n"
+            << "    --startup         Startup with a cold and a warm bytecode\n"
+            << "                      cache\n"
+            << "    --jit             Interpreter against JIT on numeric\n"
+            << "                      kernels, and JIT compile latency\n"
+            << "    --aot             Interpreter against the kernels compiled\n"
+            << "                      to C++ (needs a C++ compiler, $CXX)\n"
+            << "    --arrays          Interpreted loops against the SIMD array\n"
+            << "                      kernels\n"
+            << "    --fibers          Time per fiber context switch\n"
+            << "    --isolates        Scripts in parallel isolates, scaling\n"
+            << "                      with threads\n"
+            << "    --pmap            Loop against pmap on all cores\n\n"
+            << "Shapes: deep-nesting, wide-list, long-strings, many-defs\n\n";
+}
+
+/**
+ * Default size per corpus shape.
+ */
+size_t defaultSize(const std::string& shape) {
+  if (shape == "deep-nesting") {
+    return 200;
+  } else if (shape == "wide-list") {
+    return 1000;
+  }
+  return 50;
+}
+
+/**
+ * Vio benchmark main executable.
+ */
+int main(int argc, char const* argv[]) {
+  std::string corpus;
+  size_t size = 0;
+  size_t iterations = 3;
+  bool emit = false;
+  size_t literals = 0;
+  bool startup = false;
+  bool jit = false;
+  bool aot = false;
+  bool arrays = false;
+  bool fibers = false;
+  bool isolates = false;
+  bool parallelMap = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "-c" || arg == "--corpus") && i + 1 < argc) {
+      corpus = argv[++i];
+    } else if ((arg == "-s" || arg == "--size") && i + 1 < argc) {
+      size = std::stoul(argv[++i]);
+    } else if ((arg == "-i" || arg == "--iterations") && i + 1 < argc) {
+      iterations = std::stoul(argv[++i]);
+    } else if (arg == "--emit") {
+      emit = true;
+    } else if (arg == "--literals" && i + 1 < argc) {
+      literals = std::stoul(argv[++i]);
+    } else if (arg == "--startup") {
+      startup = true;
+    } else if (arg == "--jit") {
+      jit = true;
+    } else if (arg == "--aot") {
+      aot = true;
+    } else if (arg == "--arrays") {
+      arrays = true;
+    } else if (arg == "--fibers") {
+      fibers = true;
+    } else if (arg == "--isolates") {
+      isolates = true;
+    } else if (arg == "--pmap") {
+      parallelMap = true;
+    } else {
+      printHelp();
+      return 0;
+    }
+  }
+
+  if (literals > 0) {
+    benchLiterals(literals, iterations);
+    return 0;
+  }
+
+  if (jit) {
+    auto kernels = executionKernels();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"jit\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < kernels.size(); i++) {
+      benchJit(kernels[i].first, kernels[i].second, iterations,
+               i == kernels.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    return 0;
+  }
+
+  if (aot) {
+    auto kernels = executionKernels();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"aot\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < kernels.size(); i++) {
+      benchAot(kernels[i].first, kernels[i].second, iterations,
+               i == kernels.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    return 0;
+  }
+
+  if (arrays) {
+    auto kernels = arrayBenchKernels();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"arrays\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < kernels.size(); i++) {
+      benchArrays(kernels[i], iterations, i == kernels.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    return 0;
+  }
+
+  if (fibers) {
+    auto kernels = fiberBenchKernels();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"fibers\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < kernels.size(); i++) {
+      benchFibers(kernels[i], iterations, i == kernels.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    return 0;
+  }
+
+  if (parallelMap) {
+    benchParallelMap(iterations);
+    return 0;
+  }
+
+  if (isolates) {
+    auto kernels = executionKernels();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"isolates\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"cores\": " << std::thread::hardware_concurrency()
+              << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < kernels.size(); i++) {
+      benchIsolates(kernels[i].first, kernels[i].second, iterations,
+                    i == kernels.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    return 0;
+  }
+
+  auto shapes = corpus.empty() ? VioCorpusGenerator::shapes()
+                               : std::vector<std::string>{corpus};
+
+  if (emit) {
+    VioCorpusGenerator generator;
+    for (auto& shape : shapes) {
+      std::cout << generator.generate(shape, size ? size : defaultSize(shape));
+    }
+    return 0;
+  }
+
+  if (startup) {
+    auto directory =
+        (std::filesystem::temp_directory_path() / "vio-bench-cache").string();
+    std::cout << std::setprecision(6) << "{\n"
+              << "  \"benchmark\": \"startup\",\n"
+              << "  \"iterations\": " << iterations << ",\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < shapes.size(); i++) {
+      auto& shape = shapes[i];
+      benchStartup(shape, size ? size : defaultSize(shape), iterations,
+                   directory, i == shapes.size() - 1);
+    }
+    std::cout << "  ]\n"
+              << "}\n";
+    std::filesystem::remove_all(directory);
+    return 0;
+  }
+
+  std::cout << std::setprecision(6) << "{\n"
+            << "  \"benchmark\": \"frontend\",\n"
+            << "  \"iterations\": " << iterations << ",\n"
+            << "  \"results\": [\n";
+  for (size_t i = 0; i < shapes.size(); i++) {
+    auto& shape = shapes[i];
+    benchCorpus(shape, size ? size : defaultSize(shape), iterations,
+                i == shapes.size() - 1);
+  }
+  std::cout << "  ]\n"
+            << "}\n";
+
+  return 0;
+}
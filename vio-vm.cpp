@@ -2,19 +2,87 @@
  * Vio VM executable.
  */
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
 
 // #include "src/Logger.h"
 // #include "src/vm/VioValue.h"
+#include "src/aot/VioCppEmitter.h"
+#include "src/vm/VioSession.h"
 #include "src/vm/VioVM.h"
 
 void printHelp() {
   std::cout << "\nUsage: Vio-vm [options]\n\n"
             << "Options:\n"
             << "    -e, --expression  Expression to parse\n"
-            << "    -f, --file        File to parse\n\n";
+            << "    -f, --file        File to parse\n"
+            << "    -O0, -O1, -O2     Optimization level (default: -O1)\n"
+            << "    --repl            Interactive session\n"
+            << "    --no-quicken      Disable bytecode quickening\n"
+            << "    --no-jit          Disable the JIT\n"
+            << "    --no-trace        Don't dump the stack on each instruction\n"
+            << "                      (the JIT only runs without it)\n"
+            << "    --tiers Q,N[,L,D] Calls and loop iterations to quicken,\n"
+            << "                      calls to JIT-compile, iterations of a\n"
+            << "                      loop to compile and enter it on-stack,\n"
+            << "                      failed guards to deoptimize\n"
+            << "                      (default: 1,100,100,64)\n"
+            << "    --tier-events     Print tier promotions\n"
+            << "    --sync-jit        Compile on the VM thread, not in the\n"
+            << "                      background\n"
+            << "    --quickened       Disassemble after the run, with quickened\n"
+            << "                      instructions\n"
+            << "    --cache DIR       Bytecode cache directory (default for files:\n"
+            << "                      __viocache__ next to the file)\n"
+            << "    --no-cache        Disable the bytecode cache\n"
+            << "    --emit-cpp FILE   Compile the program to C++ instead of\n"
+            << "                      running it\n\n";
+}
+
+/**
+ * Nesting depth of parens at the end of the input (outside strings).
+ */
+int parenDepth(const std::string& input) {
+  int depth = 0;
+  bool inString = false;
+  for (auto c : input) {
+    if (c == '"') {
+      inString = !inString;
+    } else if (!inString && c == '(') {
+      depth++;
+    } else if (!inString && c == ')') {
+      depth--;
+    }
+  }
+  return depth;
+}
+
+/**
+ * Interactive session: reads expressions (continued over lines
+ * until the parens balance) and prints their values.
+ */
+int repl(OptLevel level) {
+  VioSession session(level);
+  std::string input;
+  std::string line;
+
+  std::cout << "> " << std::flush;
+  while (std::getline(std::cin, line)) {
+    input += line + "\n";
+    if (parenDepth(input) > 0) {
+      std::cout << ". " << std::flush;
+      continue;
+    }
+    if (input.find_first_not_of(" \t\n") != std::string::npos) {
+      std::cout << vioValueToConstantString(session.eval(input)) << "\n";
+    }
+    input.clear();
+    std::cout << "> " << std::flush;
+  }
+  std::cout << "\n";
+  return 0;
 }
 
 /**
@@ -23,15 +91,107 @@ void printHelp() {
 int main(int argc, char const *argv[]) {
   VioVM vm;
 
-  if (argc != 3) {
+  /**
+   * Expression mode.
+   */
+  std::string mode;
+
+  /**
+   * Expression or file name.
+   */
+  std::string input;
+
+  /**
+   * Whether to disassemble after the run.
+   */
+  bool showQuickened = false;
+
+  /**
+   * Optimization level.
+   */
+  OptLevel level = OptLevel::O1;
+
+  /**
+   * Bytecode cache directory, "-" if disabled.
+   */
+  std::string cacheDirectory;
+
+  /**
+   * C++ output file, if compiled ahead of time.
+   */
+  std::string cppFile;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-O0") {
+      level = OptLevel::O0;
+    } else if (arg == "-O1") {
+      level = OptLevel::O1;
+    } else if (arg == "-O2") {
+      level = OptLevel::O2;
+    } else if (arg == "--repl") {
+      mode = "--repl";
+    } else if (arg == "--no-quicken") {
+      vm.setQuickening(false);
+    } else if (arg == "--no-jit") {
+      vm.setJit(false);
+    } else if (arg == "--no-trace") {
+      vm.setTrace(false);
+    } else if (arg == "--tiers" && i + 1 < argc) {
+      TierThresholds thresholds;
+      if (sscanf(argv[++i], "%u,%u,%u,%u", &thresholds.quickened,
+                 &thresholds.native, &thresholds.osr,
+                 &thresholds.deopt) < 2) {
+        printHelp();
+        return 0;
+      }
+      vm.setTierThresholds(thresholds);
+    } else if (arg == "--tier-events") {
+      vm.setTierListener([](const TierEvent& event) {
+        std::cerr << "tier: " << event.co->name << "/" << event.co->arity
+                  << " " << tierToString(event.from) << " -> "
+                  << tierToString(event.to) << " (calls: " << event.co->calls
+                  << ", loops: " << event.co->loops << ")"
+                  << (event.osr ? " on-stack" : "") << "\n";
+      });
+    } else if (arg == "--sync-jit") {
+      vm.setBackgroundCompilation(false);
+    } else if (arg == "--quickened") {
+      showQuickened = true;
+    } else if (arg == "--cache" && i + 1 < argc) {
+      cacheDirectory = argv[++i];
+    } else if (arg == "--no-cache") {
+      cacheDirectory = "-";
+    } else if (arg == "--emit-cpp" && i + 1 < argc) {
+      cppFile = argv[++i];
+    } else if ((arg == "-e" || arg == "--expression" || arg == "-f" ||
+                arg == "--file") &&
+               i + 1 < argc) {
+      mode = arg[1] == '-' ? std::string("-") + arg[2] : arg;
+      input = argv[++i];
+    } else {
+      printHelp();
+      return 0;
+    }
+  }
+
+  if (mode.empty()) {
     printHelp();
     return 0;
   }
 
-  /**
-   * Expression mode.
-   */
-  std::string mode = argv[1];
+  if (mode == "--repl") {
+    return repl(level);
+  }
+  vm.setOptimizationLevel(level);
+
+  if (cacheDirectory.empty() && mode == "-f") {
+    cacheDirectory =
+        (std::filesystem::path(input).parent_path() / "__viocache__").string();
+  }
+  if (!cacheDirectory.empty() && cacheDirectory != "-") {
+    vm.setCacheDirectory(cacheDirectory);
+  }
 
   /**
    * Program to execute.
@@ -42,7 +202,7 @@ int main(int argc, char const *argv[]) {
    * Simple expression.
    */
   if (mode == "-e") {
-    program = argv[2];
+    program = input;
   }
 
   /**
@@ -50,7 +210,7 @@ int main(int argc, char const *argv[]) {
    */
   else if (mode == "-f") {
     // Read the file:
-    std::ifstream programFile(argv[2]);
+    std::ifstream programFile(input);
     std::stringstream buffer;
     buffer << programFile.rdbuf() << "\n";
 
@@ -82,7 +242,21 @@ int main(int argc, char const *argv[]) {
   //     x)
   //   x
   // )");
+  if (!cppFile.empty()) {
+    auto entry = vm.compileProgram(program);
+    std::ofstream out(cppFile);
+    out << VioCppEmitter().emit(entry, *vm.global);
+    if (!out) {
+      std::cerr << "Can't write " << cppFile << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
   auto result = vm.exec(program);
+  if (showQuickened) {
+    vm.compiler->disassembleBytecode();
+  }
   std::cout << "\n";
   // log(AS_CPPSTRING(result));
   log(result);